@@ -0,0 +1,367 @@
+#include <SDL.h>
+#include "Map.h"
+#include "LoadPNG.h"
+#include "Renderer.h"
+#include "CameraPath.h"
+#include "cxxopts.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+using namespace reb;
+
+// Ray traversal the renderer is built with
+#ifdef REBLOCHON_FIXED_POINT_TRAVERSAL
+const char* TRAVERSAL_NAME = "fixed";
+#else
+const char* TRAVERSAL_NAME = "float";
+#endif
+
+
+
+// --- Command-line parsing ---------------------------------------------------
+
+struct Settings {
+	Settings() :
+		path("data/test.map"),
+		atlas_path("data/texture-atlas-16x16.png"),
+		width(640),
+		height(480),
+		fov(60),
+		frame_count(600),
+		warmup_frame_count(10),
+		thread_count(1),
+		packet_traversal(false),
+		scanline_floors(false),
+		floor_subdivision(0),
+		fixed_kernels(false) { }
+
+	std::string path;
+	std::string atlas_path;
+	std::string camera_path;
+	std::string json_path;
+	unsigned int width;
+	unsigned int height;
+	unsigned int fov;
+	unsigned int frame_count;
+	unsigned int warmup_frame_count;
+	unsigned int thread_count;
+	bool packet_traversal;
+	bool scanline_floors;
+	unsigned int floor_subdivision;
+	bool fixed_kernels;
+}; // struct Settings
+
+
+
+void
+parse(int argc, char* argv[], Settings& settings) {
+	try {
+		cxxopts::Options options(argv[0], " - reblochon-3d renderer benchmark");
+		options
+			.add_options()
+			("i, input", "path to the map to render", cxxopts::value<std::string>(settings.path), "FILE")
+			("atlas", "path to the texture atlas", cxxopts::value<std::string>(settings.atlas_path), "FILE")
+			("camera-path", "camera path to follow, as recorded by the editor", cxxopts::value<std::string>(settings.camera_path), "FILE")
+			("width", "width of the rendered frames", cxxopts::value<unsigned int>(settings.width), "N")
+			("height", "height of the rendered frames", cxxopts::value<unsigned int>(settings.height), "N")
+			("fov", "sets the field of view angle", cxxopts::value<unsigned int>(settings.fov))
+			("frames", "number of timed frames", cxxopts::value<unsigned int>(settings.frame_count), "N")
+			("warmup", "number of frames rendered before timing", cxxopts::value<unsigned int>(settings.warmup_frame_count), "N")
+			("threads", "number of rendering threads", cxxopts::value<unsigned int>(settings.thread_count), "N")
+			("packet", "traverse the rays of adjacent columns by packets", cxxopts::value<bool>(settings.packet_traversal))
+			("scanline", "draw floors and ceilings row by row", cxxopts::value<bool>(settings.scanline_floors))
+			("floor-subdivision", "perspective correction of floors every N pixels, 0 for exact", cxxopts::value<unsigned int>(settings.floor_subdivision), "N")
+			("fixed-kernels", "step texture coordinates in fixed point when drawing walls and subdivided floors", cxxopts::value<bool>(settings.fixed_kernels))
+			("json", "also write the results as JSON to FILE, - for the standard output", cxxopts::value<std::string>(settings.json_path), "FILE")
+			("help", "Print help")
+		;
+
+		auto result = options.parse(argc, argv);
+		if (result.count("help")) {
+			std::cerr << options.help({""}) << std::endl;
+			exit(EXIT_SUCCESS);
+		}
+	}
+	catch (const cxxopts::exceptions::exception& e) {
+		std::cerr << "error parsing options: " << e.what() << std::endl;
+		exit(EXIT_FAILURE);
+	}
+
+	if ((settings.fov <= 0) or (settings.fov >= 180)) {
+		std::cerr << "field of view angle should be in the ]0, 180[ range" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+
+	if ((settings.width == 0) or (settings.height == 0)) {
+		std::cerr << "frame size should be at least 1x1" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+
+	if (settings.frame_count == 0) {
+		std::cerr << "number of frames should be at least 1" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+
+	if (settings.thread_count == 0) {
+		std::cerr << "number of rendering threads should be at least 1" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+
+	if (settings.fixed_kernels and (not settings.scanline_floors) and (settings.floor_subdivision <= 1))
+		std::cerr << "warning: fixed point kernels only apply to walls unless floors are subdivided, see --floor-subdivision" << std::endl;
+}
+
+
+
+// --- Camera path ------------------------------------------------------------
+
+/*
+ * Default camera path : a full turn on a circle around the spawn point, looking
+ * ahead, then a full turn on the spot, at eye height.
+ */
+
+CameraPath
+scripted_camera_path(const Map& map) {
+	const int step_count = 64;
+	const float radius = 4.f;
+
+	CameraPath camera_path;
+	Eigen::Vector2f center = map.spawn_point();
+	for(int k = 0; k <= step_count; ++k) {
+		float theta = (2 * M_PI * k) / step_count;
+		Eigen::Vector3f pos(center.x() + radius * std::cos(theta), center.y() + radius * std::sin(theta), 1.7f);
+		camera_path.pose_list().push_back(CameraPath::Pose(pos, theta + M_PI / 2));
+	}
+
+	for(int k = 1; k <= step_count; ++k) {
+		float theta = (2 * M_PI * k) / step_count;
+		Eigen::Vector3f pos(center.x() + radius, center.y(), 1.7f);
+		camera_path.pose_list().push_back(CameraPath::Pose(pos, M_PI / 2 + theta));
+	}
+
+	return camera_path;
+}
+
+
+
+// --- Results ----------------------------------------------------------------
+
+class Results {
+public:
+	// Frame times in seconds
+	Results(const std::vector<double>& frame_time_list, int ray_per_frame_count) {
+		std::vector<double> sorted_list(frame_time_list);
+		std::sort(sorted_list.begin(), sorted_list.end());
+
+		double total = 0;
+		for(double frame_time : sorted_list)
+			total += frame_time;
+
+		m_mean = total / sorted_list.size();
+		m_p50 = percentile(sorted_list, 50);
+		m_p99 = percentile(sorted_list, 99);
+		m_max = sorted_list.back();
+		m_rays_per_second = (double(ray_per_frame_count) * sorted_list.size()) / total;
+	}
+
+	inline double mean() const { return m_mean; }
+
+	inline double p50() const { return m_p50; }
+
+	inline double p99() const { return m_p99; }
+
+	inline double max() const { return m_max; }
+
+	inline double rays_per_second() const { return m_rays_per_second; }
+
+private:
+	// Nearest-rank percentile of a sorted list
+	static double
+	percentile(const std::vector<double>& sorted_list, int p) {
+		std::size_t rank = (p * sorted_list.size() + 99) / 100;
+		return sorted_list[std::max<std::size_t>(rank, 1) - 1];
+	}
+
+	double m_mean, m_p50, m_p99, m_max;
+	double m_rays_per_second;
+}; // class Results
+
+
+
+void
+print_results(const Settings& settings, const Results& results) {
+	printf("map        %s\n", settings.path.c_str());
+	printf("frames     %u at %ux%u, %u thread(s)%s%s%s\n",
+	       settings.frame_count, settings.width, settings.height, settings.thread_count,
+	       settings.packet_traversal ? ", packet traversal" : "",
+	       settings.scanline_floors ? ", scanline floors" : "",
+	       settings.fixed_kernels ? ", fixed point kernels" : "");
+	printf("traversal  %s\n", TRAVERSAL_NAME);
+	printf("mean       %8.3f ms\n", 1e3 * results.mean());
+	printf("p50        %8.3f ms\n", 1e3 * results.p50());
+	printf("p99        %8.3f ms\n", 1e3 * results.p99());
+	printf("max        %8.3f ms\n", 1e3 * results.max());
+	printf("rays/s     %8.3f M\n", 1e-6 * results.rays_per_second());
+}
+
+
+
+// Writes str as a JSON string, quotes included
+void
+write_json_string(FILE* file, const char* str) {
+	fputc('"', file);
+	for( ; *str; ++str) {
+		unsigned char c = *str;
+		if ((c == '"') or (c == '\\'))
+			fprintf(file, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(file, "\\u%04x", c);
+		else
+			fputc(c, file);
+	}
+	fputc('"', file);
+}
+
+
+
+bool
+write_json_results(const Settings& settings, const Results& results) {
+	FILE* file = settings.json_path == "-" ? stdout : fopen(settings.json_path.c_str(), "w");
+	if (!file) {
+		SDL_SetError("could not open '%s' for writing", settings.json_path.c_str());
+		return false;
+	}
+
+	fprintf(file, "{\n");
+	fprintf(file, "  \"map\": ");
+	write_json_string(file, settings.path.c_str());
+	fprintf(file, ",\n");
+	fprintf(file, "  \"width\": %u,\n", settings.width);
+	fprintf(file, "  \"height\": %u,\n", settings.height);
+	fprintf(file, "  \"frames\": %u,\n", settings.frame_count);
+	fprintf(file, "  \"threads\": %u,\n", settings.thread_count);
+	fprintf(file, "  \"packet_traversal\": %s,\n", settings.packet_traversal ? "true" : "false");
+	fprintf(file, "  \"scanline_floors\": %s,\n", settings.scanline_floors ? "true" : "false");
+	fprintf(file, "  \"floor_subdivision\": %u,\n", settings.floor_subdivision);
+	fprintf(file, "  \"fixed_kernels\": %s,\n", settings.fixed_kernels ? "true" : "false");
+	fprintf(file, "  \"traversal\": ");
+	write_json_string(file, TRAVERSAL_NAME);
+	fprintf(file, ",\n");
+	fprintf(file, "  \"mean_ms\": %.6f,\n", 1e3 * results.mean());
+	fprintf(file, "  \"p50_ms\": %.6f,\n", 1e3 * results.p50());
+	fprintf(file, "  \"p99_ms\": %.6f,\n", 1e3 * results.p99());
+	fprintf(file, "  \"max_ms\": %.6f,\n", 1e3 * results.max());
+	fprintf(file, "  \"rays_per_second\": %.1f\n", results.rays_per_second());
+	fprintf(file, "}\n");
+
+	if ((file != stdout) and (fclose(file) != 0)) {
+		SDL_SetError("could not write '%s'", settings.json_path.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+
+
+// --- Main entry point -------------------------------------------------------
+
+int
+main(int argc, char* argv[]) {
+	// Command-line parsing
+	Settings settings;
+	parse(argc, argv, settings);
+
+	// Map loading
+	Map map;
+	if (!Map::load(settings.path.c_str(), map)) {
+		SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Could not load map '%s': %s\n", settings.path.c_str(), SDL_GetError());
+		return EXIT_FAILURE;
+	}
+
+	// Camera path loading
+	CameraPath camera_path;
+	if (!settings.camera_path.empty()) {
+		if (!CameraPath::load(settings.camera_path.c_str(), camera_path)) {
+			SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Could not load camera path '%s': %s\n", settings.camera_path.c_str(), SDL_GetError());
+			return EXIT_FAILURE;
+		}
+	}
+	else
+		camera_path = scripted_camera_path(map);
+
+	// Load the texture atlas
+	SDL_Surface* texture_atlas = load_png(settings.atlas_path.c_str());
+	if (!texture_atlas) {
+		SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Could not load texture atlas: %s\n", SDL_GetError());
+		return EXIT_FAILURE;
+	}
+
+	// Create an offscreen indexed color framebuffer
+	SDL_Surface* framebuffer =
+		SDL_CreateRGBSurface(0,
+		                     settings.width, settings.height, 8,
+		                     0x00000000,
+		                     0x00000000,
+		                     0x00000000,
+		                     0x00000000);
+	if (!framebuffer) {
+		SDL_LogError(SDL_LOG_CATEGORY_VIDEO, "Could not create framebuffer: %s\n", SDL_GetError());
+		SDL_FreeSurface(texture_atlas);
+		return EXIT_FAILURE;
+	}
+
+	// Setup the renderer
+	Renderer view_renderer(settings.width, settings.height,
+	                       texture_atlas,
+	                       Renderer::focal_length_from_angle((M_PI / 180.f) * settings.fov),
+	                       settings.thread_count);
+	view_renderer.packet_traversal() = settings.packet_traversal;
+	if (settings.scanline_floors)
+		view_renderer.floor_mode() = Renderer::SCANLINE_FLOOR_MODE;
+	view_renderer.floor_subdivision() = settings.floor_subdivision;
+	if (settings.fixed_kernels)
+		view_renderer.kernel_mode() = Renderer::FIXED_KERNEL_MODE;
+
+	// Warm up the caches and the threads
+	for(unsigned int k = 0; k < settings.warmup_frame_count; ++k) {
+		CameraPath::Pose pose = camera_path.interpolate(float(k) / settings.warmup_frame_count);
+		view_renderer.render(framebuffer, map, pose.angle(), pose.pos());
+	}
+
+	// Render the frames along the camera path
+	std::vector<double> frame_time_list(settings.frame_count);
+	for(unsigned int k = 0; k < settings.frame_count; ++k) {
+		CameraPath::Pose pose = camera_path.interpolate(settings.frame_count > 1 ? float(k) / (settings.frame_count - 1) : 0.f);
+
+		auto start = std::chrono::steady_clock::now();
+		view_renderer.render(framebuffer, map, pose.angle(), pose.pos());
+		auto end = std::chrono::steady_clock::now();
+
+		frame_time_list[k] = std::chrono::duration<double>(end - start).count();
+	}
+
+	// Report the results
+	Results results(frame_time_list, settings.width);
+	if (settings.json_path != "-")
+		print_results(settings, results);
+
+	bool json_ok = true;
+	if (!settings.json_path.empty())
+		json_ok = write_json_results(settings, results);
+
+	// Free ressources
+	SDL_FreeSurface(framebuffer);
+	SDL_FreeSurface(texture_atlas);
+
+	if (!json_ok) {
+		SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Could not write results: %s\n", SDL_GetError());
+		return EXIT_FAILURE;
+	}
+
+	// Job done
+	return EXIT_SUCCESS;
+}
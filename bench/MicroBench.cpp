@@ -0,0 +1,538 @@
+#include <SDL.h>
+#include "Arena.h"
+#include "Map.h"
+#include "Renderer.h"
+#include "RayTraversal.h"
+#include "FixedRayTraversal.h"
+#include "cxxopts.h"
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace reb;
+
+
+
+// --- Command-line parsing ---------------------------------------------------
+
+struct Settings {
+	Settings() :
+		map_size(1024),
+		column_height(480),
+		fragment_count(64),
+		seed(1234),
+		min_time(200) { }
+
+	unsigned int map_size;
+	unsigned int column_height;
+	unsigned int fragment_count;
+	unsigned int seed;
+	unsigned int min_time;
+	std::string filter;
+}; // struct Settings
+
+
+
+void
+parse(int argc, char* argv[], Settings& settings) {
+	try {
+		cxxopts::Options options(argv[0], " - reblochon-3d renderer primitives microbenchmarks");
+		options
+			.add_options()
+			("map-size", "width and height of the grid traversed by the rays", cxxopts::value<unsigned int>(settings.map_size), "N")
+			("column-height", "height of the columns, in pixels", cxxopts::value<unsigned int>(settings.column_height), "N")
+			("fragment-count", "number of cells per column fragment stream", cxxopts::value<unsigned int>(settings.fragment_count), "N")
+			("seed", "seed of the random inputs", cxxopts::value<unsigned int>(settings.seed), "N")
+			("min-time", "minimum time spent on each benchmark, in milliseconds", cxxopts::value<unsigned int>(settings.min_time), "N")
+			("filter", "only run the benchmarks whose name contains STRING", cxxopts::value<std::string>(settings.filter), "STRING")
+			("help", "Print help")
+		;
+
+		auto result = options.parse(argc, argv);
+		if (result.count("help")) {
+			std::cerr << options.help({""}) << std::endl;
+			exit(EXIT_SUCCESS);
+		}
+	}
+	catch (const cxxopts::exceptions::exception& e) {
+		std::cerr << "error parsing options: " << e.what() << std::endl;
+		exit(EXIT_FAILURE);
+	}
+
+	if ((settings.map_size == 0) or (settings.column_height < 2) or (settings.fragment_count == 0)) {
+		std::cerr << "map size, column height and fragment count should be positive" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+
+// --- Measurement ------------------------------------------------------------
+
+// Results are accumulated there, so that the compiler cannot drop the work
+static volatile std::uint64_t sink = 0;
+
+
+
+// Work done by one batch : operations, and items for the throughput
+struct BatchSize {
+	std::uint64_t op_count;
+	std::uint64_t item_count;
+}; // struct BatchSize
+
+
+
+/*
+ * Runs batches until the minimum time is spent, then reports the best batch,
+ * as time per operation and items per second.
+ */
+
+template <class F>
+void
+run(const Settings& settings, const char* name, const char* item_name, F& batch) {
+	if (std::string(name).find(settings.filter) == std::string::npos)
+		return;
+
+	// Warm up the caches
+	batch();
+
+	double best_time = -1;
+	BatchSize best_size = { 0, 0 };
+	double total_time = 0;
+	while(total_time * 1e3 < settings.min_time) {
+		auto start = std::chrono::steady_clock::now();
+		BatchSize size = batch();
+		auto end = std::chrono::steady_clock::now();
+
+		double time = std::chrono::duration<double>(end - start).count();
+		total_time += time;
+		if ((best_time < 0) or (time / size.op_count < best_time / best_size.op_count)) {
+			best_time = time;
+			best_size = size;
+		}
+	}
+
+	printf("%-32s %10.2f ns/op %10.2f M%s/s\n",
+	       name,
+	       1e9 * best_time / best_size.op_count,
+	       1e-6 * best_size.item_count / best_time,
+	       item_name);
+}
+
+
+
+// --- Inputs -----------------------------------------------------------------
+
+/*
+ * Fragments of a column, as the renderer would produce them : walking away
+ * from the viewer over mostly flat cells, with a floor and a wall per cell.
+ */
+
+std::vector<Renderer::Column>
+fragment_stream(const Settings& settings, std::mt19937& rng) {
+	const float view_height = 1.7f;
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+	std::uniform_real_distribution<float> step(.3f, 1.2f);
+
+	auto project = [&](float height, float dist) {
+		return settings.column_height * ((view_height - height) / dist + .5f);
+	};
+
+	std::vector<Renderer::Column> column_list;
+	float prev_dist = .5f;
+	for(unsigned int k = 0; k < settings.fragment_count; ++k) {
+		float dist = prev_dist + step(rng);
+		float height = unit(rng) < .8f ? 0.f : float(1 + rng() % 3);
+
+		if (height < view_height)
+			column_list.push_back(
+				Renderer::Column(project(height, dist), project(height, prev_dist), dist, prev_dist,
+				                 unit(rng), unit(rng), unit(rng), unit(rng), rng() % 256, 256 * height));
+
+		float u = unit(rng);
+		column_list.push_back(
+			Renderer::Column(project(height, prev_dist), project(0, prev_dist), prev_dist, prev_dist,
+			                 u, u, 0, height, rng() % 256));
+
+		prev_dist = dist;
+	}
+
+	return column_list;
+}
+
+
+
+// Column fragments covering most of a column, for the draw kernels
+std::vector<Renderer::Column>
+kernel_column_list(const Settings& settings, std::mt19937& rng) {
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+
+	std::vector<Renderer::Column> column_list;
+	for(int k = 0; k < 256; ++k) {
+		float y_start = (.25f * unit(rng)) * settings.column_height;
+		float y_end   = (.75f + .25f * unit(rng)) * settings.column_height;
+		float z_start = 1.f + 2 * unit(rng);
+		column_list.push_back(
+			Renderer::Column(y_start, y_end, z_start + 4 * unit(rng), z_start,
+			                 unit(rng), unit(rng), unit(rng), 1 + 2 * unit(rng), rng() % 256));
+	}
+
+	return column_list;
+}
+
+
+
+// A texture atlas filled with noise, to not depend on data files
+SDL_Surface*
+noise_texture_atlas(std::mt19937& rng) {
+	SDL_Surface* surface = SDL_CreateRGBSurface(0, 256, 256, 8, 0, 0, 0, 0);
+	if (!surface)
+		return 0;
+
+	for(int j = 0; j < surface->h; ++j) {
+		std::uint8_t* pixel = (std::uint8_t*)surface->pixels + j * surface->pitch;
+		for(int i = 0; i < surface->w; ++i)
+			pixel[i] = rng() % 256;
+	}
+
+	return surface;
+}
+
+
+
+// --- RayTraversal -----------------------------------------------------------
+
+void
+bench_ray_traversal(const Settings& settings) {
+	const int ray_count = 4096;
+
+	std::mt19937 rng(settings.seed);
+	std::uniform_real_distribution<float> unit(-1.f, 1.f);
+
+	Grid2d grid(Eigen::Vector2i(settings.map_size, settings.map_size), 1.f);
+	float extent = grid.extent().x();
+
+	// Rays starting inside the grid, in random directions
+	std::vector<Eigen::Vector2f> inside_origin_list, inside_direction_list;
+	for(int k = 0; k < ray_count; ++k) {
+		inside_origin_list.push_back(extent * Eigen::Vector2f(unit(rng), unit(rng)));
+		inside_direction_list.push_back(Eigen::Vector2f(unit(rng), unit(rng)).normalized());
+	}
+
+	// Rays starting outside the grid, aimed at a random point of the grid
+	std::vector<Eigen::Vector2f> outside_origin_list, outside_direction_list;
+	for(int k = 0; k < ray_count; ++k) {
+		float theta = M_PI * unit(rng);
+		Eigen::Vector2f origin = 2 * extent * Eigen::Vector2f(std::cos(theta), std::sin(theta));
+		Eigen::Vector2f target = extent * Eigen::Vector2f(unit(rng), unit(rng));
+		outside_origin_list.push_back(origin);
+		outside_direction_list.push_back((target - origin).normalized());
+	}
+
+	auto construct = [&](const std::vector<Eigen::Vector2f>& origin_list,
+	                     const std::vector<Eigen::Vector2f>& direction_list) {
+		std::uint64_t acc = 0;
+		for(int k = 0; k < ray_count; ++k) {
+			RayTraversal traversal(grid, origin_list[k], direction_list[k]);
+			acc += traversal.i() + traversal.j();
+		}
+		sink += acc;
+		return BatchSize { ray_count, ray_count };
+	};
+
+	auto construct_inside = [&]() {
+		return construct(inside_origin_list, inside_direction_list);
+	};
+	run(settings, "traversal/construct-inside", "rays", construct_inside);
+
+	auto construct_outside = [&]() {
+		return construct(outside_origin_list, outside_direction_list);
+	};
+	run(settings, "traversal/construct-outside", "rays", construct_outside);
+
+	// Same, with the reciprocals of the directions computed beforehand
+	std::vector<Eigen::Vector2f> inside_inv_direction_list;
+	for(const Eigen::Vector2f& direction : inside_direction_list)
+		inside_inv_direction_list.push_back(direction.cwiseInverse());
+
+	auto construct_inside_precomputed = [&]() {
+		std::uint64_t acc = 0;
+		for(int k = 0; k < ray_count; ++k) {
+			RayTraversal traversal(grid, inside_origin_list[k], inside_direction_list[k], inside_inv_direction_list[k]);
+			acc += traversal.i() + traversal.j();
+		}
+		sink += acc;
+		return BatchSize { ray_count, ray_count };
+	};
+	run(settings, "traversal/construct-inv-dir", "rays", construct_inside_precomputed);
+
+	auto step = [&]() {
+		std::uint64_t step_count = 0;
+		std::uint64_t acc = 0;
+		for(int k = 0; k < ray_count; ++k) {
+			RayTraversal traversal(grid, inside_origin_list[k], inside_direction_list[k]);
+			for( ; traversal.has_next(); traversal.next(), ++step_count)
+				acc += traversal.axis();
+		}
+		sink += acc;
+		return BatchSize { step_count, step_count };
+	};
+	run(settings, "traversal/step", "cells", step);
+
+	auto step_fixed = [&]() {
+		std::uint64_t step_count = 0;
+		std::uint64_t acc = 0;
+		for(int k = 0; k < ray_count; ++k) {
+			FixedRayTraversal traversal(grid, inside_origin_list[k], inside_direction_list[k]);
+			for( ; traversal.has_next(); traversal.next(), ++step_count)
+				acc += traversal.axis();
+		}
+		sink += acc;
+		return BatchSize { step_count, step_count };
+	};
+	run(settings, "traversal/step-fixed", "cells", step_fixed);
+
+	// Empty space skipping over blocks of 16x16 cells
+	auto skip_block = [&]() {
+		std::uint64_t jumped_count = 0;
+		float acc = 0;
+		for(int k = 0; k < ray_count; ++k) {
+			RayTraversal traversal(grid, inside_origin_list[k], inside_direction_list[k]);
+			while(traversal.has_next()) {
+				float distance;
+				int axis;
+				jumped_count += traversal.skip_block(4, distance, axis);
+				acc += distance;
+			}
+		}
+		sink += std::uint64_t(acc);
+		return BatchSize { jumped_count, jumped_count };
+	};
+	run(settings, "traversal/skip-block-16", "cells", skip_block);
+}
+
+
+
+// --- CoverageBuffer and Column ----------------------------------------------
+
+void
+bench_cell_reads(const Settings& settings) {
+	const int ray_count = 4096;
+
+	std::mt19937 rng(settings.seed);
+	std::uniform_real_distribution<float> unit(-1.f, 1.f);
+
+	Grid2d grid(Eigen::Vector2i(settings.map_size, settings.map_size), 1.f);
+	float extent = grid.extent().x();
+
+	// Dense cells, in Morton order as in a map, and row by row
+	typedef ChunkedArray2dT<Map::Cell, RowMajorLayout> row_major_array_type;
+	Map::cell_array_type morton_array(settings.map_size, settings.map_size);
+	row_major_array_type row_major_array(settings.map_size, settings.map_size);
+	for(unsigned int j = 0; j < settings.map_size; ++j) {
+		for(unsigned int i = 0; i < settings.map_size; ++i) {
+			Map::Cell cell;
+			cell.height() = rng() & 0xffff;
+			morton_array(i, j) = cell;
+			row_major_array(i, j) = cell;
+		}
+	}
+
+	// Rays starting inside the grid, in random directions
+	std::vector<Eigen::Vector2f> origin_list, direction_list;
+	for(int k = 0; k < ray_count; ++k) {
+		origin_list.push_back(extent * Eigen::Vector2f(unit(rng), unit(rng)));
+		direction_list.push_back(Eigen::Vector2f(unit(rng), unit(rng)).normalized());
+	}
+
+	auto read_indexed = [&](const auto& cell_array) {
+		std::uint64_t step_count = 0;
+		std::uint64_t acc = 0;
+		for(int k = 0; k < ray_count; ++k) {
+			RayTraversal traversal(grid, origin_list[k], direction_list[k]);
+			for( ; traversal.has_next(); traversal.next(), ++step_count)
+				acc += cell_array(traversal.i(), traversal.j()).height();
+		}
+		sink += acc;
+		return BatchSize { step_count, step_count };
+	};
+
+	auto read_cursor = [&](const auto& cell_array) {
+		std::uint64_t step_count = 0;
+		std::uint64_t acc = 0;
+		for(int k = 0; k < ray_count; ++k) {
+			RayTraversal traversal(grid, origin_list[k], direction_list[k]);
+			typename std::decay<decltype(cell_array)>::type::Cursor cursor(cell_array, traversal.i(), traversal.j());
+			for( ; traversal.has_next(); ++step_count) {
+				acc += (*cursor).height();
+
+				int axis = traversal.axis();
+				cursor.step(axis, traversal.index_delta(axis));
+				traversal.next();
+			}
+		}
+		sink += acc;
+		return BatchSize { step_count, step_count };
+	};
+
+	auto read_row_major = [&]() {
+		return read_indexed(row_major_array);
+	};
+	run(settings, "cells/read-row-major", "cells", read_row_major);
+
+	auto read_morton = [&]() {
+		return read_indexed(morton_array);
+	};
+	run(settings, "cells/read-morton", "cells", read_morton);
+
+	auto read_row_major_cursor = [&]() {
+		return read_cursor(row_major_array);
+	};
+	run(settings, "cells/read-row-major-cursor", "cells", read_row_major_cursor);
+
+	auto read_morton_cursor = [&]() {
+		return read_cursor(morton_array);
+	};
+	run(settings, "cells/read-morton-cursor", "cells", read_morton_cursor);
+}
+
+
+
+void
+bench_coverage_buffer(const Settings& settings) {
+	const int stream_count = 64;
+
+	std::mt19937 rng(settings.seed);
+
+	std::vector<std::vector<Renderer::Column>> stream_list;
+	for(int k = 0; k < stream_count; ++k)
+		stream_list.push_back(fragment_stream(settings, rng));
+
+	Arena arena(Renderer::CoverageBuffer::footprint(settings.column_height));
+	Renderer::CoverageBuffer coverage_buffer(settings.column_height, arena);
+
+	auto add = [&]() {
+		std::uint64_t add_count = 0;
+		std::uint64_t acc = 0;
+		for(std::vector<Renderer::Column>& stream : stream_list) {
+			coverage_buffer.clear();
+			for(Renderer::Column& column : stream)
+				coverage_buffer.add(column);
+
+			add_count += stream.size();
+			acc += coverage_buffer.end() - coverage_buffer.begin();
+		}
+		sink += acc;
+		return BatchSize { add_count, add_count };
+	};
+	run(settings, "coverage-buffer/add", "fragments", add);
+
+	// Clip full height columns to random sub-ranges
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+	std::vector<Renderer::Column> column_list = kernel_column_list(settings, rng);
+	std::vector<std::pair<int, int>> range_list;
+	for(std::size_t k = 0; k < column_list.size(); ++k) {
+		int y_lo = int(std::ceil(column_list[k].y_start())) + 1;
+		int y_hi = int(column_list[k].y_end());
+		int y_mid = y_lo + int(unit(rng) * (y_hi - y_lo));
+		range_list.push_back(std::make_pair(y_lo, std::max(y_mid, y_lo + 1)));
+	}
+
+	auto clip = [&]() {
+		float acc = 0;
+		for(std::size_t k = 0; k < column_list.size(); ++k) {
+			Renderer::Column column = column_list[k];
+			column.clip(range_list[k].first, range_list[k].second);
+			acc += column.u_start() + column.v_end();
+		}
+		sink += std::uint64_t(acc);
+		return BatchSize { column_list.size(), column_list.size() };
+	};
+	run(settings, "column/clip", "fragments", clip);
+}
+
+
+
+// --- Draw kernels -----------------------------------------------------------
+
+void
+bench_kernels(const Settings& settings) {
+	std::mt19937 rng(settings.seed);
+
+	SDL_Surface* texture_atlas = noise_texture_atlas(rng);
+	if (!texture_atlas) {
+		SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Could not create texture atlas: %s\n", SDL_GetError());
+		return;
+	}
+
+	Renderer renderer(1, settings.column_height, texture_atlas, Renderer::focal_length_from_angle((M_PI / 180.f) * 60));
+	SDL_FreeSurface(texture_atlas);
+
+	std::vector<Renderer::Column> column_list = kernel_column_list(settings, rng);
+	std::vector<std::uint8_t> pixel_list(settings.column_height);
+
+	std::uint64_t pixel_count = 0;
+	for(const Renderer::Column& column : column_list)
+		pixel_count += int(column.y_end() - column.y_start());
+
+	auto draw_wall = [&]() {
+		for(const Renderer::Column& column : column_list)
+			renderer.draw_wall_column(pixel_list.data(), column);
+		sink += pixel_list[settings.column_height / 2];
+		return BatchSize { column_list.size(), pixel_count };
+	};
+	run(settings, "kernel/wall", "pixels", draw_wall);
+
+	auto draw_floor = [&]() {
+		for(const Renderer::Column& column : column_list)
+			renderer.draw_floor_column(pixel_list.data(), column);
+		sink += pixel_list[settings.column_height / 2];
+		return BatchSize { column_list.size(), pixel_count };
+	};
+
+	renderer.floor_subdivision() = 0;
+	run(settings, "kernel/floor", "pixels", draw_floor);
+
+	renderer.floor_subdivision() = 16;
+	run(settings, "kernel/floor-subdivided-16", "pixels", draw_floor);
+
+	auto draw_wall_fixed = [&]() {
+		for(const Renderer::Column& column : column_list)
+			renderer.draw_wall_column_fixed(pixel_list.data(), column);
+		sink += pixel_list[settings.column_height / 2];
+		return BatchSize { column_list.size(), pixel_count };
+	};
+	run(settings, "kernel/wall-fixed", "pixels", draw_wall_fixed);
+
+	auto draw_floor_fixed = [&]() {
+		for(const Renderer::Column& column : column_list)
+			renderer.draw_floor_column_fixed(pixel_list.data(), column);
+		sink += pixel_list[settings.column_height / 2];
+		return BatchSize { column_list.size(), pixel_count };
+	};
+	run(settings, "kernel/floor-subdivided-16-fixed", "pixels", draw_floor_fixed);
+}
+
+
+
+// --- Main entry point -------------------------------------------------------
+
+int
+main(int argc, char* argv[]) {
+	// Command-line parsing
+	Settings settings;
+	parse(argc, argv, settings);
+
+	printf("map size %u, column height %u, fragment count %u, seed %u\n",
+	       settings.map_size, settings.column_height, settings.fragment_count, settings.seed);
+
+	bench_ray_traversal(settings);
+	bench_cell_reads(settings);
+	bench_coverage_buffer(settings);
+	bench_kernels(settings);
+
+	// Job done
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,90 @@
+#ifndef REBLOCHON_ALIGNED_ALLOCATOR_H
+#define REBLOCHON_ALIGNED_ALLOCATOR_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <sys/mman.h>
+
+
+
+namespace reb {
+	/*
+	 * Standard allocator returning blocks aligned on Alignment bytes, a power
+	 * of two multiple of sizeof(void*). The default alignment is a cache line,
+	 * so that no two threads share the cache lines of different blocks. With
+	 * huge_page_alignment, the kernel is asked to back the blocks with huge
+	 * pages, saving TLB misses over large arrays. Blocks smaller than a huge
+	 * page are then only aligned on a cache line, to avoid wasting most of a
+	 * huge page on them.
+	 */
+
+	enum {
+		cache_line_alignment = 64,
+		huge_page_alignment = 2 << 20
+	};
+
+
+
+	template <class T, std::size_t Alignment = cache_line_alignment>
+	class AlignedAllocatorT {
+	public:
+		typedef T           value_type;
+		typedef std::size_t size_type;
+
+		enum {
+			alignment = Alignment
+		};
+
+		template <class U>
+		struct rebind {
+			typedef AlignedAllocatorT<U, Alignment> other;
+		}; // struct rebind
+
+
+
+		inline AlignedAllocatorT() { }
+
+		template <class U>
+		inline AlignedAllocatorT(const AlignedAllocatorT<U, Alignment>&) { }
+
+		inline T*
+		allocate(size_type count) {
+			size_type size = count * sizeof(T);
+			bool huge = (Alignment >= huge_page_alignment) and (size >= huge_page_alignment);
+
+			void* data = 0;
+			if (posix_memalign(&data, huge ? Alignment : std::min<size_type>(Alignment, cache_line_alignment), size) != 0)
+				throw std::bad_alloc();
+
+			#ifdef MADV_HUGEPAGE
+			if (huge)
+				madvise(data, size, MADV_HUGEPAGE);
+			#endif
+
+			return static_cast<T*>(data);
+		}
+
+		inline void
+		deallocate(T* data, size_type) {
+			std::free(data);
+		}
+
+		template <class U>
+		inline bool
+		operator == (const AlignedAllocatorT<U, Alignment>&) const {
+			return true;
+		}
+
+		template <class U>
+		inline bool
+		operator != (const AlignedAllocatorT<U, Alignment>&) const {
+			return false;
+		}
+	}; // class AlignedAllocatorT
+} // namespace reb
+
+
+
+#endif // REBLOCHON_ALIGNED_ALLOCATOR_H
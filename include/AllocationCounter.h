@@ -0,0 +1,24 @@
+#ifndef REBLOCHON_ALLOCATION_COUNTER_H
+#define REBLOCHON_ALLOCATION_COUNTER_H
+
+#include <cstdint>
+
+
+
+namespace reb {
+	/*
+	 * Counts the calls to the global new and delete operators, made by any
+	 * thread, so that code paths which should not allocate can be checked.
+	 * Only available when REBLOCHON_ALLOCATION_CHECK is defined, as replacing
+	 * the global operators slows down every allocation.
+	 */
+
+	class AllocationCounter {
+	public:
+		static std::uint64_t count();
+	}; // class AllocationCounter
+} // namespace reb
+
+
+
+#endif // REBLOCHON_ALLOCATION_COUNTER_H
@@ -0,0 +1,72 @@
+#ifndef REBLOCHON_ARENA_H
+#define REBLOCHON_ARENA_H
+
+#include <cassert>
+#include <cstddef>
+#include "ArrayT.h"
+
+
+
+namespace reb {
+	/*
+	 * Bump allocator over a block of memory allocated once. Allocating moves a
+	 * cursor forward, and everything is released at once by a reset, in
+	 * constant time. Objects allocated from an arena are never destroyed, thus
+	 * they should be trivially destructible. The block is aligned on a cache
+	 * line.
+	 */
+
+	class Arena {
+	public:
+		typedef std::size_t size_type;
+
+
+
+		Arena(size_type capacity);
+
+		Arena(const Arena& other) = delete;
+
+		Arena& operator = (const Arena& other) = delete;
+
+		inline size_type
+		capacity() const {
+			return m_buffer.size();
+		}
+
+		inline size_type
+		used() const {
+			return m_used;
+		}
+
+		// Storage for count objects of type T, left uninitialized
+		template <class T>
+		inline T*
+		allocate(size_type count) {
+			size_type start = (m_used + alignof(T) - 1) & ~(alignof(T) - 1);
+			assert(start + count * sizeof(T) <= capacity());
+
+			m_used = start + count * sizeof(T);
+			return reinterpret_cast<T*>(m_buffer.data() + start);
+		}
+
+		inline void
+		reset() {
+			m_used = 0;
+		}
+
+		// Bytes needed to allocate count objects of type T, alignment included
+		template <class T>
+		static inline size_type
+		footprint(size_type count) {
+			return count * sizeof(T) + alignof(T) - 1;
+		}
+
+	private:
+		ArrayT<unsigned char> m_buffer;
+		size_type m_used;
+	}; // class Arena
+} // namespace reb
+
+
+
+#endif // REBLOCHON_ARENA_H
@@ -1,32 +1,269 @@
 #ifndef REBLOCHON_ARRAY_2D_H
 #define REBLOCHON_ARRAY_2D_H
 
+#include <cstddef>
+#include <utility>
 #include <ArrayT.h>
 
 
 
 namespace reb {
-	template <class T>
+	/*
+	 * Layouts of the values of a 2d array : the number of values to allocate
+	 * and the index of the value (i, j). The cursor of a layout is the index
+	 * of a value moved to its neighbours one step at a time, cheaper than
+	 * computing the index again.
+	 */
+
+	// Row after row
+	class RowMajorLayout {
+	public:
+		typedef std::size_t size_type;
+
+		class Cursor {
+		public:
+			inline Cursor() :
+				m_index(0),
+				m_row_size(0) { }
+
+			inline Cursor(const RowMajorLayout& layout, int i, int j) :
+				m_index(layout.index(i, j)),
+				m_row_size(layout.m_w) { }
+
+			inline size_type
+			index() const {
+				return m_index;
+			}
+
+			// delta is either 1, -1 or 0
+			inline void
+			step_i(int delta) {
+				m_index += size_type(delta);
+			}
+
+			inline void
+			step_j(int delta) {
+				m_index += size_type(delta) * m_row_size;
+			}
+
+		private:
+			size_type m_index;
+			size_type m_row_size;
+		}; // class Cursor
+
+
+
+		inline RowMajorLayout(size_type w, size_type h) :
+			m_w(w),
+			m_h(h) { }
+
+		inline size_type
+		size() const {
+			return m_w * m_h;
+		}
+
+		inline size_type
+		index(int i, int j) const {
+			return m_w * j + i;
+		}
+
+	private:
+		size_type m_w, m_h;
+	}; // class RowMajorLayout
+
+
+
+	// Tiles of 64x64 values, row after row. The values of a tile are in
+	// Morton order, interleaving the bits of i and j : a cache line holds a
+	// square block of values, whatever the direction they are visited in.
+	class MortonLayout {
+	public:
+		typedef std::size_t size_type;
+
+		enum {
+			tile_shift = 6,
+			tile_size = 1 << tile_shift,
+			tile_area = tile_size * tile_size
+		};
+
+		// The Morton code is stepped along an axis without decoding it, by
+		// carrying through the bits of the other axis
+		class Cursor {
+		public:
+			inline Cursor() :
+				m_tile(0),
+				m_x(0),
+				m_y(0),
+				m_tile_row_size(0) { }
+
+			inline Cursor(const MortonLayout& layout, int i, int j) :
+				m_tile(layout.tile_index(i, j)),
+				m_x(dilate(i & (tile_size - 1))),
+				m_y(dilate(j & (tile_size - 1)) << 1),
+				m_tile_row_size(layout.m_tile_w * tile_area) { }
+
+			inline size_type
+			index() const {
+				return m_tile + (m_x | m_y);
+			}
+
+			// delta is either 1, -1 or 0
+			inline void
+			step_i(int delta) {
+				step(m_x, x_mask, delta, tile_area);
+			}
+
+			inline void
+			step_j(int delta) {
+				step(m_y, y_mask, delta, m_tile_row_size);
+			}
+
+		private:
+			enum {
+				x_mask = 0x555,
+				y_mask = 0xaaa
+			};
+
+			inline void
+			step(size_type& code, size_type mask, int delta, size_type tile_delta) {
+				if (delta > 0) {
+					code = ((code | ~mask) + 1) & mask;
+					if (code == 0)
+						m_tile += tile_delta;
+				}
+				else if (delta < 0) {
+					if (code == 0)
+						m_tile -= tile_delta;
+					code = (code - 1) & mask;
+				}
+			}
+
+
+
+			size_type m_tile;
+			size_type m_x, m_y;
+			size_type m_tile_row_size;
+		}; // class Cursor
+
+
+
+		inline MortonLayout(size_type w, size_type h) :
+			m_tile_w((w + tile_size - 1) >> tile_shift),
+			m_tile_h((h + tile_size - 1) >> tile_shift) { }
+
+		inline size_type
+		size() const {
+			return m_tile_w * m_tile_h * tile_area;
+		}
+
+		inline size_type
+		index(int i, int j) const {
+			return tile_index(i, j) + (dilate(i & (tile_size - 1)) | (dilate(j & (tile_size - 1)) << 1));
+		}
+
+	private:
+		inline size_type
+		tile_index(int i, int j) const {
+			return (m_tile_w * size_type(j >> tile_shift) + size_type(i >> tile_shift)) * tile_area;
+		}
+
+		// Spreads the 6 bits of x on the even bits
+		static inline size_type
+		dilate(unsigned int x) {
+			x = (x | (x << 4)) & 0x30f;
+			x = (x | (x << 2)) & 0x333;
+			x = (x | (x << 1)) & 0x555;
+			return x;
+		}
+
+
+
+		size_type m_tile_w, m_tile_h;
+	}; // class MortonLayout
+
+
+
+	// The values are stored in an ArrayT, from Allocator
+	template <class T, class Layout = RowMajorLayout, class Allocator = AlignedAllocatorT<T> >
 	class Array2dT {
 	public:
 		typedef T           value_type;
+		typedef Layout      layout_type;
+		typedef Allocator   allocator_type;
 		typedef std::size_t size_type;
 
+		// Value moved to its neighbours one step at a time
+		class Cursor {
+		public:
+			inline Cursor(const Array2dT<T, Layout, Allocator>& array, int i, int j) :
+				m_data(array.m_data.data()),
+				m_cursor(array.m_layout, i, j) { }
 
+			inline const value_type&
+			operator * () const {
+				return m_data[m_cursor.index()];
+			}
 
-		inline Array2dT() :
+			inline void
+			step_i(int delta) {
+				m_cursor.step_i(delta);
+			}
+
+			inline void
+			step_j(int delta) {
+				m_cursor.step_j(delta);
+			}
+
+		private:
+			const T* m_data;
+			typename Layout::Cursor m_cursor;
+		}; // class Cursor
+
+
+
+		inline Array2dT(const Allocator& allocator = Allocator()) :
 			m_w(0),
 			m_h(0),
-			m_data(0) { }
+			m_layout(0, 0),
+			m_data(allocator) { }
 
 		inline Array2dT(size_type w,
-		                size_type h) :
+		                size_type h,
+		                const Allocator& allocator = Allocator()) :
 			m_w(w),
 			m_h(h),
-			m_data(w * h) {
+			m_layout(w, h),
+			m_data(m_layout.size(), allocator) {
 		}
 
-		inline Array2dT(const Array2dT<T>& other) = default;
+		inline Array2dT(const Array2dT<T, Layout, Allocator>& other) = default;
+
+		// Moving leaves other empty, of size 0x0
+		inline Array2dT(Array2dT<T, Layout, Allocator>&& other) noexcept :
+			m_w(other.m_w),
+			m_h(other.m_h),
+			m_layout(other.m_layout),
+			m_data(std::move(other.m_data)) {
+			other.m_w = 0;
+			other.m_h = 0;
+			other.m_layout = Layout(0, 0);
+		}
+
+		inline Array2dT<T, Layout, Allocator>& operator = (const Array2dT<T, Layout, Allocator>& other) = default;
+
+		inline Array2dT<T, Layout, Allocator>& operator = (Array2dT<T, Layout, Allocator>&& other) noexcept {
+			if (this != &other) {
+				m_w = other.m_w;
+				m_h = other.m_h;
+				m_layout = other.m_layout;
+				m_data = std::move(other.m_data);
+				other.m_w = 0;
+				other.m_h = 0;
+				other.m_layout = Layout(0, 0);
+			}
+
+			return *this;
+		}
 
 		inline size_type w() const {
 			return m_w;
@@ -36,34 +273,35 @@ namespace reb {
 			return m_h;
 		}
 
-		inline ArrayT<T>& data() {
+		inline const Layout& layout() const {
+			return m_layout;
+		}
+
+		// Values in the order of the layout
+		inline ArrayT<T, Allocator>& data() {
 			return m_data;
 		}
 
-		inline const ArrayT<T>& data() const {
+		inline const ArrayT<T, Allocator>& data() const {
 			return m_data;
 		}
 
-		
+
 
 		inline value_type&
 		operator () (int i, int j) {
-			return m_data[index(i, j)];
+			return m_data[m_layout.index(i, j)];
 		}
 
 		inline const value_type&
 		operator () (int i, int j) const {
-			return m_data[index(i, j)];
+			return m_data[m_layout.index(i, j)];
 		}
 
 	private:
-		size_type
-		index(int i, int j) const {
-			return m_w * j + i;
-		}
-
 		size_type m_w, m_h;
-		ArrayT<T> m_data;
+		Layout m_layout;
+		ArrayT<T, Allocator> m_data;
 	}; // class Array2dT
 } // namespace reb
 
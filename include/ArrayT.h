@@ -2,6 +2,10 @@
 #define SAUCATS_REBLOCHON_ARRAY_T_H
 
 #include <algorithm>
+#include <memory>
+#include <new>
+#include <utility>
+#include "AlignedAllocatorT.h"
 
 
 
@@ -14,12 +18,18 @@ namespace reb {
 	 *   - Works out of the box with most of STL
 	 *   - Allocation/deallocation is far more automated
 	 *   - As efficient as plain array 
+	 *
+	 * The storage comes from Allocator, a standard allocator, aligned on a
+	 * cache line by default. The values are default-initialized, as with
+	 * new[]. Moving an array hands over its storage and its allocator, leaving
+	 * the source empty.
 	 */
 
-	template <class T>
+	template <class T, class Allocator = AlignedAllocatorT<T> >
 	class ArrayT {
 	public:
 		typedef T           value_type;
+		typedef Allocator   allocator_type;
 		typedef T*          iterator;
 		typedef const T*    const_iterator;
 		typedef T&          reference;
@@ -29,28 +39,40 @@ namespace reb {
 
 
 
-		inline ArrayT() :
+		inline ArrayT(const Allocator& allocator = Allocator()) :
+			m_allocator(allocator),
 			m_size(0),
 			m_data(0) { }
 
-		inline ArrayT(size_type size) :
+		inline ArrayT(size_type size,
+		              const Allocator& allocator = Allocator()) :
+			m_allocator(allocator),
 			m_size(size) {
 			allocate();
 		}
 
-		inline ArrayT(const ArrayT<T>& other) : 
+		inline ArrayT(const ArrayT<T, Allocator>& other) : 
+			m_allocator(allocator_traits::select_on_container_copy_construction(other.m_allocator)),
 			m_size(other.size()) {
 			allocate();
 			std::copy(other.begin(), other.end(), begin());
 		}
 
+		inline ArrayT(ArrayT<T, Allocator>&& other) noexcept :
+			m_allocator(std::move(other.m_allocator)),
+			m_size(other.m_size),
+			m_data(other.m_data) {
+			other.m_size = 0;
+			other.m_data = 0;
+		}
+
 		inline ~ArrayT() {
 			dispose();
 		}
 
 
 
-		inline ArrayT<T>& operator = (const ArrayT<T>& other) {
+		inline ArrayT<T, Allocator>& operator = (const ArrayT<T, Allocator>& other) {
 			if (size() != other.size()) {
 				dispose();
 				m_size = other.size();
@@ -61,6 +83,25 @@ namespace reb {
 			return *this;
 		}
 
+		inline ArrayT<T, Allocator>& operator = (ArrayT<T, Allocator>&& other) noexcept {
+			if (this != &other) {
+				dispose();
+				m_allocator = std::move(other.m_allocator);
+				m_size = other.m_size;
+				m_data = other.m_data;
+				other.m_size = 0;
+				other.m_data = 0;
+			}
+
+			return *this;
+		}
+
+
+
+		inline const Allocator& get_allocator() const {
+			return m_allocator;
+		}
+
 
 
 		inline iterator begin() {
@@ -132,17 +173,30 @@ namespace reb {
 		}
 
 	private:
+		typedef std::allocator_traits<Allocator> allocator_traits;
+
+
+
 		void allocate() {
-			m_data = new T[m_size];
+			m_data = m_size ? allocator_traits::allocate(m_allocator, m_size) : 0;
+			for(size_type i = 0; i < m_size; ++i)
+				new (m_data + i) T;
 		}
 
 		void dispose() {
-			if (m_data)
-				delete[] m_data;
+			if (m_data) {
+				for(size_type i = 0; i < m_size; ++i)
+					m_data[i].~T();
+				allocator_traits::deallocate(m_allocator, m_data, m_size);
+			}
+
+			m_size = 0;
+			m_data = 0;
 		}
 
 
 
+		Allocator m_allocator;
 		size_type m_size;
 		T* m_data;
 	}; // class ArrayT
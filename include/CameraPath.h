@@ -0,0 +1,79 @@
+#ifndef REBLOCHON_CAMERA_PATH_H
+#define REBLOCHON_CAMERA_PATH_H
+
+#include <vector>
+#include <Eigen/Dense>
+
+
+
+namespace reb {
+	/*
+	 * Sequence of camera poses, a position and a view angle, with linear
+	 * interpolation in between. Stored as a text file, one pose per line :
+	 * x, y, z and the angle in radians, separated by spaces.
+	 */
+
+	class CameraPath {
+	public:
+		class Pose {
+		public:
+			Pose() :
+				m_pos(Eigen::Vector3f::Zero()),
+				m_angle(0.f) { }
+
+			Pose(const Eigen::Vector3f& pos, float angle) :
+				m_pos(pos),
+				m_angle(angle) { }
+
+			inline const Eigen::Vector3f&
+			pos() const {
+				return m_pos;
+			}
+
+			inline Eigen::Vector3f&
+			pos() {
+				return m_pos;
+			}
+
+			inline float
+			angle() const {
+				return m_angle;
+			}
+
+			inline float&
+			angle() {
+				return m_angle;
+			}
+
+		private:
+			Eigen::Vector3f m_pos;
+			float m_angle;
+		}; // class Pose
+
+
+
+		inline const std::vector<Pose>&
+		pose_list() const {
+			return m_pose_list;
+		}
+
+		inline std::vector<Pose>&
+		pose_list() {
+			return m_pose_list;
+		}
+
+		// Pose at s in [0, 1], from the first to the last pose of the path
+		Pose interpolate(float s) const;
+
+		bool save(const char* path) const;
+
+		static bool load(const char* path, CameraPath& camera_path);
+
+	private:
+		std::vector<Pose> m_pose_list;
+	}; // class CameraPath
+} // namespace reb
+
+
+
+#endif // REBLOCHON_CAMERA_PATH_H
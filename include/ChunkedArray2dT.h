@@ -0,0 +1,337 @@
+#ifndef REBLOCHON_CHUNKED_ARRAY_2D_H
+#define REBLOCHON_CHUNKED_ARRAY_2D_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include "Array2dT.h"
+
+
+
+namespace reb {
+	/*
+	 * Sparse 2d array, split in square chunks of chunk_size x chunk_size
+	 * values behind a chunk directory. A chunk whose values are all the same is
+	 * stored as that single value, thus the memory used grows with the number
+	 * of non-uniform chunks rather than with the area.
+	 *
+	 * Reads are branch free : each entry of the directory holds the offset of
+	 * the chunk values in a shared pool, and a mask applied to the index within
+	 * the chunk, null for a uniform chunk. Values of the chunks on the right and
+	 * bottom edges which are out of the array are not part of the array, they
+	 * are never compared nor read. The values of a dense chunk are stored in
+	 * the order of Layout, in a pool allocated from Allocator.
+	 */
+
+	template <class T, class Layout = RowMajorLayout, class Allocator = AlignedAllocatorT<T> >
+	class ChunkedArray2dT {
+	public:
+		typedef T           value_type;
+		typedef Layout      layout_type;
+		typedef Allocator   allocator_type;
+		typedef std::size_t size_type;
+
+		enum {
+			chunk_shift = 6,
+			chunk_size = 1 << chunk_shift,
+			chunk_value_count = chunk_size * chunk_size
+		};
+
+		// Value moved to its neighbours one step at a time, the directory being
+		// looked up only when moving to another chunk. Positions out of the
+		// array are allowed, as long as they are not read. The array should not
+		// be empty, and modifying it invalidates its cursors.
+		class Cursor {
+		public:
+			// Unpositioned, to be assigned
+			inline Cursor() :
+				m_array(0),
+				m_i(0),
+				m_j(0),
+				m_value_list(0),
+				m_mask(0) { }
+
+			inline Cursor(const ChunkedArray2dT<T, Layout, Allocator>& array, int i, int j) :
+				m_array(&array) {
+				seek(i, j);
+			}
+
+			inline void
+			seek(int i, int j) {
+				m_i = i;
+				m_j = j;
+				assert((m_array->m_chunk_w > 0) and (m_array->m_chunk_h > 0));
+
+				// Out of the array, use the nearest chunk
+				size_type chunk_i = std::min(size_type(std::max(i >> chunk_shift, 0)), m_array->m_chunk_w - 1);
+				size_type chunk_j = std::min(size_type(std::max(j >> chunk_shift, 0)), m_array->m_chunk_h - 1);
+				const Chunk& chunk = m_array->m_chunk_list[m_array->m_chunk_w * chunk_j + chunk_i];
+
+				m_value_list = m_array->m_value_list.data() + chunk.offset;
+				m_mask = chunk.mask;
+				m_cursor = typename Layout::Cursor(m_array->m_chunk_layout, i & (chunk_size - 1), j & (chunk_size - 1));
+			}
+
+			inline const value_type&
+			operator * () const {
+				return m_value_list[m_cursor.index() & m_mask];
+			}
+
+			// delta is either 1, -1 or 0
+			inline void
+			step(int axis, int delta) {
+				if (axis == 0)
+					step_i(delta);
+				else
+					step_j(delta);
+			}
+
+			inline void
+			step_i(int delta) {
+				m_i += delta;
+				if ((m_i & (chunk_size - 1)) == (delta > 0 ? 0 : chunk_size - 1))
+					seek(m_i, m_j);
+				else
+					m_cursor.step_i(delta);
+			}
+
+			inline void
+			step_j(int delta) {
+				m_j += delta;
+				if ((m_j & (chunk_size - 1)) == (delta > 0 ? 0 : chunk_size - 1))
+					seek(m_i, m_j);
+				else
+					m_cursor.step_j(delta);
+			}
+
+		private:
+			const ChunkedArray2dT<T, Layout, Allocator>* m_array;
+			int m_i, m_j;
+			const T* m_value_list;
+			size_type m_mask;
+			typename Layout::Cursor m_cursor;
+		}; // class Cursor
+
+
+
+		inline ChunkedArray2dT(const Allocator& allocator = Allocator()) :
+			m_w(0),
+			m_h(0),
+			m_chunk_w(0),
+			m_chunk_h(0),
+			m_value_list(allocator),
+			m_chunk_layout(chunk_size, chunk_size),
+			m_last_uniform_offset(0) { }
+
+		inline ChunkedArray2dT(size_type w,
+		                       size_type h,
+		                       const T& value = T(),
+		                       const Allocator& allocator = Allocator()) :
+			m_w(w),
+			m_h(h),
+			m_chunk_w((w + chunk_size - 1) >> chunk_shift),
+			m_chunk_h((h + chunk_size - 1) >> chunk_shift),
+			m_value_list(1, value, allocator),
+			m_chunk_list(m_chunk_w * m_chunk_h, Chunk { 0, 0 }),
+			m_chunk_layout(chunk_size, chunk_size),
+			m_last_uniform_offset(0) { }
+
+		inline ChunkedArray2dT(const ChunkedArray2dT<T, Layout, Allocator>& other) = default;
+
+		// Moving leaves other empty, of size 0x0
+		inline ChunkedArray2dT(ChunkedArray2dT<T, Layout, Allocator>&& other) noexcept :
+			m_w(other.m_w),
+			m_h(other.m_h),
+			m_chunk_w(other.m_chunk_w),
+			m_chunk_h(other.m_chunk_h),
+			m_value_list(std::move(other.m_value_list)),
+			m_chunk_list(std::move(other.m_chunk_list)),
+			m_chunk_layout(other.m_chunk_layout),
+			m_last_uniform_offset(other.m_last_uniform_offset) {
+			other.clear_size();
+		}
+
+		inline ChunkedArray2dT<T, Layout, Allocator>& operator = (const ChunkedArray2dT<T, Layout, Allocator>& other) = default;
+
+		inline ChunkedArray2dT<T, Layout, Allocator>& operator = (ChunkedArray2dT<T, Layout, Allocator>&& other) noexcept {
+			if (this != &other) {
+				m_w = other.m_w;
+				m_h = other.m_h;
+				m_chunk_w = other.m_chunk_w;
+				m_chunk_h = other.m_chunk_h;
+				m_value_list = std::move(other.m_value_list);
+				m_chunk_list = std::move(other.m_chunk_list);
+				m_last_uniform_offset = other.m_last_uniform_offset;
+				other.clear_size();
+			}
+
+			return *this;
+		}
+
+		inline size_type w() const {
+			return m_w;
+		}
+
+		inline size_type h() const {
+			return m_h;
+		}
+
+		// Size of the array in chunks
+		inline size_type chunk_w() const {
+			return m_chunk_w;
+		}
+
+		inline size_type chunk_h() const {
+			return m_chunk_h;
+		}
+
+		inline bool
+		is_uniform_chunk(size_type chunk_i, size_type chunk_j) const {
+			return m_chunk_list[m_chunk_w * chunk_j + chunk_i].mask == 0;
+		}
+
+		// Number of chunks storing all of their values
+		inline size_type
+		dense_chunk_count() const {
+			return std::count_if(m_chunk_list.begin(), m_chunk_list.end(), [](const Chunk& chunk) { return chunk.mask != 0; });
+		}
+
+		// Memory used by the values and the directory, in bytes
+		inline size_type
+		footprint() const {
+			return m_value_list.capacity() * sizeof(T) + m_chunk_list.capacity() * sizeof(Chunk);
+		}
+
+		// Makes room in the pool for values of chunks to be assigned, so that it
+		// is allocated once : dense_count dense chunks, and up to uniform_count
+		// uniform chunks
+		inline void
+		reserve_chunks(size_type dense_count, size_type uniform_count) {
+			m_value_list.reserve(m_value_list.size() + dense_count * chunk_value_count + uniform_count);
+		}
+
+		// Replaces the values of a chunk, given row by row in value_list, which
+		// holds chunk_value_count values. The chunk is stored as a single value
+		// if its values in the array are all the same, and it is not dense yet.
+		void
+		assign_chunk(size_type chunk_i, size_type chunk_j, const T* value_list) {
+			Chunk& chunk = m_chunk_list[m_chunk_w * chunk_j + chunk_i];
+
+			// Extent of the chunk within the array
+			size_type i_count = std::min(m_w - (chunk_i << chunk_shift), size_type(chunk_size));
+			size_type j_count = std::min(m_h - (chunk_j << chunk_shift), size_type(chunk_size));
+
+			bool uniform = true;
+			for(size_type j = 0; (j < j_count) and uniform; ++j)
+				for(size_type i = 0; (i < i_count) and uniform; ++i)
+					uniform = value_list[(j << chunk_shift) + i] == value_list[0];
+
+			if (uniform and (chunk.mask == 0))
+				chunk.offset = uniform_offset(value_list[0]);
+			else {
+				make_dense(chunk);
+
+				T* dst = m_value_list.data() + chunk.offset;
+				for(int j = 0; j < chunk_size; ++j)
+					for(int i = 0; i < chunk_size; ++i)
+						dst[m_chunk_layout.index(i, j)] = value_list[(j << chunk_shift) + i];
+			}
+		}
+
+		// Values of a chunk in the order of Layout, chunk_value_count of them,
+		// to be written as they are. The chunk is made dense first.
+		inline value_type*
+		dense_chunk_data(size_type chunk_i, size_type chunk_j) {
+			Chunk& chunk = m_chunk_list[m_chunk_w * chunk_j + chunk_i];
+			make_dense(chunk);
+			return m_value_list.data() + chunk.offset;
+		}
+
+		// Sets all the values of a chunk, stored as a single value unless the
+		// chunk is already dense
+		inline void
+		fill_chunk(size_type chunk_i, size_type chunk_j, const T& value) {
+			Chunk& chunk = m_chunk_list[m_chunk_w * chunk_j + chunk_i];
+			if (chunk.mask == 0)
+				chunk.offset = uniform_offset(value);
+			else
+				std::fill(m_value_list.begin() + chunk.offset, m_value_list.begin() + chunk.offset + chunk_value_count, value);
+		}
+
+		inline const value_type&
+		operator () (int i, int j) const {
+			const Chunk& chunk = m_chunk_list[chunk_index(i, j)];
+			return m_value_list[chunk.offset + (m_chunk_layout.index(i & (chunk_size - 1), j & (chunk_size - 1)) & chunk.mask)];
+		}
+
+		// The chunk holding the value is made dense first, invalidating the
+		// references to the other values
+		inline value_type&
+		operator () (int i, int j) {
+			Chunk& chunk = m_chunk_list[chunk_index(i, j)];
+			make_dense(chunk);
+			return m_value_list[chunk.offset + m_chunk_layout.index(i & (chunk_size - 1), j & (chunk_size - 1))];
+		}
+
+	private:
+		struct Chunk {
+			size_type offset;
+			size_type mask;
+		}; // struct Chunk
+
+
+
+		inline void
+		clear_size() {
+			m_w = 0;
+			m_h = 0;
+			m_chunk_w = 0;
+			m_chunk_h = 0;
+			m_value_list.clear();
+			m_chunk_list.clear();
+			m_last_uniform_offset = 0;
+		}
+
+		inline size_type
+		chunk_index(int i, int j) const {
+			return m_chunk_w * size_type(j >> chunk_shift) + size_type(i >> chunk_shift);
+		}
+
+		// Runs of chunks with the same value share it
+		inline size_type
+		uniform_offset(const T& value) {
+			if (!(m_value_list[m_last_uniform_offset] == value)) {
+				m_last_uniform_offset = m_value_list.size();
+				m_value_list.push_back(value);
+			}
+
+			return m_last_uniform_offset;
+		}
+
+		inline void
+		make_dense(Chunk& chunk) {
+			if (chunk.mask != 0)
+				return;
+
+			T value = m_value_list[chunk.offset];
+			chunk.offset = m_value_list.size();
+			chunk.mask = chunk_value_count - 1;
+			m_value_list.resize(m_value_list.size() + chunk_value_count, value);
+		}
+
+
+
+		size_type m_w, m_h;
+		size_type m_chunk_w, m_chunk_h;
+		std::vector<T, Allocator> m_value_list;
+		std::vector<Chunk> m_chunk_list;
+		Layout m_chunk_layout;
+		size_type m_last_uniform_offset;
+	}; // class ChunkedArray2dT
+} // namespace reb
+
+
+
+#endif // REBLOCHON_CHUNKED_ARRAY_2D_H
@@ -0,0 +1,169 @@
+#ifndef REBLOCHON_FIXED_RAY_TRAVERSAL_H
+#define REBLOCHON_FIXED_RAY_TRAVERSAL_H
+
+#include <cstdint>
+#include "RayTraversal.h"
+
+
+
+namespace reb {
+	/*
+	 * Same interface as RayTraversal, stepping the ray parameters in 32.32
+	 * fixed point. The setup is done in floating point by a RayTraversal, then
+	 * the ray parameters are converted exactly. Stepping is an integer add, and
+	 * the axis of the next crossing is cached rather than searched for.
+	 *
+	 * Each sum is rounded to the precision of a float, to nearest even, as the
+	 * floating point traversal does, thus both visit exactly the same cells at
+	 * exactly the same distances. This holds as long as the ray parameters are
+	 * multiples of 2^-32, which all floats of at least 2^-9 are. The smaller
+	 * ones, such as the signed zeros of a ray starting on a cell boundary, are
+	 * kept aside as floats.
+	 */
+
+	class FixedRayTraversal {
+	public:
+		typedef std::int64_t fixed_type;
+
+		enum {
+			fraction_bits = 32
+		};
+
+
+
+		FixedRayTraversal(const Grid2d& grid,
+		                  const Eigen::Vector2f& origin,
+		                  const Eigen::Vector2f& direction);
+
+		FixedRayTraversal(const Grid2d& grid,
+		                  const Eigen::Vector2f& origin,
+		                  const Eigen::Vector2f& direction,
+		                  const Eigen::Vector2f& inv_direction);
+
+		inline float
+		distance_init() const {
+			return m_t_init;
+		}
+
+		inline int
+		axis_init() const {
+			return m_axis_init;
+		}
+
+		inline int
+		axis() const {
+			return m_axis;
+		}
+
+		inline float
+		distance() const {
+			return ray_parameter(m_axis);
+		}
+
+		inline void
+		next() {
+			if (m_axis) {
+				m_t[1] = round(m_t[1] + m_t_delta[1]);
+				m_index[1] += m_index_delta[1];
+			}
+			else {
+				m_t[0] = round(m_t[0] + m_t_delta[0]);
+				m_index[0] += m_index_delta[0];
+			}
+			m_axis = m_t[1] < m_t[0];
+		}
+
+		inline bool
+		has_next() const {
+			return
+				((unsigned int)m_index[0] < (unsigned int)m_size[0]) and
+				((unsigned int)m_index[1] < (unsigned int)m_size[1]);
+		}
+
+		inline int
+		i() const {
+			return m_index[0];
+		}
+
+		inline int
+		j() const {
+			return m_index[1];
+		}
+
+		// Step of the cell index along the axis, 1, -1, or 0 if the ray never
+		// crosses that axis
+		inline int
+		index_delta(int axis) const {
+			return m_index_delta[axis];
+		}
+
+		// Number of cells left to visit, the current one included
+		int remaining_count() const;
+
+		// Distance at which the ray leaves the block of 2^level x 2^level cells
+		// holding the current cell
+		float block_exit_distance(int level) const;
+
+		// Moves to the first cell past the block of 2^level x 2^level cells
+		// holding the current cell, as RayTraversal::skip_block does
+		int skip_block(int level, float& distance, int& axis);
+
+	private:
+		// Rounds a positive value to the 24 significant bits of a float, to
+		// nearest even
+		static inline fixed_type
+		round(fixed_type x) {
+			int shift = (63 - __builtin_clzll(x)) - 23;
+			if (shift <= 0)
+				return x;
+
+			fixed_type bias = (fixed_type(1) << (shift - 1)) - 1 + ((x >> shift) & 1);
+			return (x + bias) & ~((fixed_type(1) << shift) - 1);
+		}
+
+		static fixed_type to_fixed(float x);
+
+		static inline float
+		to_float(fixed_type x) {
+			return float(x) * (1.f / float(fixed_type(1) << fraction_bits));
+		}
+
+		enum {
+			// 2^-9, the smallest ray parameter represented exactly
+			small_threshold = 1 << (fraction_bits - 9)
+		};
+
+		inline float
+		ray_parameter(int i) const {
+			return m_t[i] >= small_threshold ? to_float(m_t[i]) : m_small_t[i];
+		}
+
+		// t + count * t_delta, rounded as the floating point traversal does
+		static fixed_type step(fixed_type t, int count, fixed_type t_delta);
+
+		void init(const RayTraversal& traversal);
+
+		// The seldom used operations are delegated to a RayTraversal in the
+		// same state
+		RayTraversal to_ray_traversal() const;
+
+
+
+		float m_t_init;
+		int m_axis_init;
+		int m_axis;
+		fixed_type m_t[2];
+		fixed_type m_t_delta[2];
+
+		// Ray parameters below 2^-9 as floats, as they might not be multiples
+		// of 2^-32. Only the first crossing along each axis can be that close.
+		float m_small_t[2];
+		int m_size[2];
+		int m_index_delta[2];
+		int m_index[2];
+	}; // class FixedRayTraversal
+} // namespace reb
+
+
+
+#endif // REBLOCHON_FIXED_RAY_TRAVERSAL_H
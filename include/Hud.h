@@ -0,0 +1,36 @@
+#ifndef REBLOCHON_HUD_H
+#define REBLOCHON_HUD_H
+
+#include <SDL.h>
+#include <cstdint>
+#include "Profiler.h"
+
+
+
+namespace reb {
+	/*
+	 * Heads-up display of the profiler averages, drawn over an 8 bits indexed
+	 * colors surface with a tiny built-in 3x5 pixels font.
+	 */
+
+	class Hud {
+	public:
+		Hud(const SDL_Palette* palette);
+
+		void draw(SDL_Surface* dst, const Profiler& profiler) const;
+
+	private:
+		void draw_text(SDL_Surface* dst, int x, int y, const char* text) const;
+
+		void fill_rect(SDL_Surface* dst, int x, int y, int w, int h, std::uint8_t color) const;
+
+
+
+		std::uint8_t m_text_color;
+		std::uint8_t m_background_color;
+	}; // class Hud
+} // namespace reb
+
+
+
+#endif // REBLOCHON_HUD_H
@@ -2,55 +2,73 @@
 #define REBLOCHON_MAP_H
 
 #include <cstdint>
+#include <vector>
 #include <Eigen/Dense>
-#include "Array2dT.h"
+#include "ChunkedArray2dT.h"
 
 
 
 namespace reb {
 	class Map {
 	public:
+		/*
+		 * Cells are packed in 4 bytes, so that a cache line holds 16 of them : the
+		 * height, in 1/256 units, on 16 bits, then the wall and floor texture ids
+		 * on a byte each, as there are 256 textures at most.
+		 */
+
 		class Cell {
 		public:
 			Cell();
 
-			inline std::uint32_t
+			inline std::uint16_t
 			height() const {
 				return m_height;
 			}
 
-			inline std::uint32_t&
+			inline std::uint16_t&
 			height() {
 				return m_height;
 			}
 
-			inline unsigned int
+			inline std::uint8_t
 			wall_texture_id() const {
 				return m_wall_texture_id;
 			}
 
-			inline unsigned int&
+			inline std::uint8_t&
 			wall_texture_id() {
 				return m_wall_texture_id;
 			}
 
-			inline unsigned int
+			inline std::uint8_t
 			floor_texture_id() const {
 				return m_floor_texture_id;
 			}
 
-			inline unsigned int&
+			inline std::uint8_t&
 			floor_texture_id() {
 				return m_floor_texture_id;
 			}
 
+			inline bool
+			operator == (const Cell& other) const {
+				return (m_height == other.m_height) and (m_wall_texture_id == other.m_wall_texture_id) and (m_floor_texture_id == other.m_floor_texture_id);
+			}
+
 		private:
-			std::uint32_t m_height;
-			unsigned int m_wall_texture_id;
-			unsigned int m_floor_texture_id;
+			std::uint16_t m_height;
+			std::uint8_t m_wall_texture_id;
+			std::uint8_t m_floor_texture_id;
 		}; // class Cell
 
-		typedef reb::Array2dT<Cell> cell_array_type;
+		// Cells are stored by chunks of 64x64, a chunk of identical cells taking
+		// the space of a single cell, thus large and mostly empty maps are cheap.
+		// Within a chunk, cells are in Morton order so that rays of any direction
+		// find their next cells in the same cache lines. Large cell pools are
+		// backed by huge pages, as rays read cells all over the map.
+		typedef reb::ChunkedArray2dT<Cell, MortonLayout, AlignedAllocatorT<Cell, huge_page_alignment> > cell_array_type;
+		typedef reb::ChunkedArray2dT<std::uint16_t, MortonLayout> height_array_type;
 
 
 
@@ -78,11 +96,56 @@ namespace reb {
 			return m_cell_array;
 		}
 
+		// Number of levels of the max height pyramid, 0 if it is not built
+		inline int
+		max_height_level_count() const {
+			return m_max_height_pyramid.size();
+		}
+
+		// Maximum cell height over the block of 2^level x 2^level cells holding
+		// the cell (i, j), for level in [1, max_height_level_count()]
+		inline std::uint16_t
+		max_height(int level, int i, int j) const {
+			return m_max_height_pyramid[level - 1](i >> level, j >> level);
+		}
+
+		// Has to be called again whenever the cells heights are modified
+		void build_max_height_pyramid();
+
+		// Loads a map file, of format version 1 or 2. Both start with the
+		// 'reblochon3d-map' signature followed by the version number, LE32.
+		//
+		// Version 1 is a sequence of tags : 'spawn' with the spawn point as two
+		// LE32, in 1/256 units, and '_map_' with the size as two LE16, then for
+		// each cell, i-major, the height as LE32 and the wall and floor texture
+		// ids as two bytes.
+		//
+		// Version 2 has a fixed header, then a directory of the chunks of 64x64
+		// cells, row by row, then the cells of the dense chunks, stored as they
+		// are laid out in cell_array() so that they are copied as they are.
+		//   19  reserved byte
+		//   20  width, LE32
+		//   24  height, LE32
+		//   28  spawn point, two LE32 in 1/256 units
+		//   36  offset of the cells of the dense chunks from the start of the
+		//       file, LE32, a multiple of 64
+		//   40  chunk directory, then reserved up to the cells
+		// An entry of the directory takes 8 bytes : 0 as LE32 then the cell of
+		// a uniform chunk, or 1 as LE32 then 4 reserved bytes for a dense chunk.
+		// A cell takes 4 bytes : the height as LE16, the wall and floor texture
+		// ids. The dense chunks follow each other in the order of the directory,
+		// each with its 64x64 cells in Morton order : the cell (i, j) within the
+		// chunk is at the index whose even bits are those of i, and odd bits
+		// those of j. Cells out of the map are ignored.
+		//
+		// Version 1 cells higher than 65535 are rejected, as they do not fit in
+		// a Cell. On failure, map is left unchanged.
 		static bool load(const char* path, Map& map);
 
 	private:
 		Eigen::Vector2f m_spawn_point;
 		cell_array_type m_cell_array;
+		std::vector<height_array_type> m_max_height_pyramid;
 	}; // class Map
 } // namespace reb
 
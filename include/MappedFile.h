@@ -0,0 +1,53 @@
+#ifndef REBLOCHON_MAPPED_FILE_H
+#define REBLOCHON_MAPPED_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+
+
+
+namespace reb {
+	/*
+	 * Read-only mapping of a whole file in memory. Pages are read from the
+	 * file on first access, and the mapping is released on destruction.
+	 */
+
+	class MappedFile {
+	public:
+		typedef std::size_t size_type;
+
+
+
+		MappedFile();
+
+		MappedFile(const MappedFile& other) = delete;
+
+		~MappedFile();
+
+		MappedFile& operator = (const MappedFile& other) = delete;
+
+		// Returns false and sets the SDL error on failure
+		bool open(const char* path);
+
+		void close();
+
+		// Null for an empty file
+		inline const std::uint8_t*
+		data() const {
+			return m_data;
+		}
+
+		inline size_type
+		size() const {
+			return m_size;
+		}
+
+	private:
+		const std::uint8_t* m_data;
+		size_type m_size;
+	}; // class MappedFile
+} // namespace reb
+
+
+
+#endif // REBLOCHON_MAPPED_FILE_H
@@ -0,0 +1,114 @@
+#ifndef REBLOCHON_PRESENTER_H
+#define REBLOCHON_PRESENTER_H
+
+#include <SDL.h>
+#include <cstdint>
+#include <vector>
+#include "ThreadPool.h"
+
+
+
+namespace reb {
+	/*
+	 * Copies an 8 bits indexed colors surface to a display surface, replacing
+	 * SDL_BlitSurface. Indices are expanded through a table of the 256 palette
+	 * colors converted to the native pixel format of the display surface, 8
+	 * pixels at a time with AVX2 gathers when available. The rows can be split
+	 * over the threads of a pool. Display surfaces which are not 32 bits per
+	 * pixel are handed to SDL_BlitSurface.
+	 *
+	 * The source is centered on the display surface, and can be scaled up to
+	 * fill it : each source row is expanded once, then its nearest pixels are
+	 * picked, with AVX2 permutes when upscaling. A destination row which samples
+	 * the same source row as the previous one is a copy of it.
+	 */
+
+	class Presenter {
+	public:
+		enum ScaleMode {
+			// Pixels are copied as is
+			NO_SCALE_MODE,
+
+			// Largest integer scale which fits, sharp but letterboxed
+			INTEGER_SCALE_MODE,
+
+			// Largest scale which fits while keeping the aspect ratio
+			STRETCH_SCALE_MODE
+		}; // enum ScaleMode
+
+
+
+		Presenter(const SDL_Palette* palette, ThreadPool* thread_pool = 0);
+
+		void set_palette(const SDL_Palette* palette);
+
+		inline ScaleMode
+		scale_mode() const {
+			return m_scale_mode;
+		}
+
+		inline ScaleMode&
+		scale_mode() {
+			return m_scale_mode;
+		}
+
+		// Copies src to dst, centered and scaled according to the scale mode
+		bool present(SDL_Surface* src, SDL_Surface* dst);
+
+		// Rectangle of dst covered by src, as of the last call to present()
+		inline const SDL_Rect&
+		dst_rect() const {
+			return m_dst_rect;
+		}
+
+		// Expands count indices through the table
+		static void expand_row(const std::uint8_t* src,
+		                       std::uint32_t* dst,
+		                       int count,
+		                       const std::uint32_t* table);
+
+		// Expands the indices src[x_list[i]], i in [0, count[, through the
+		// table, x_list being increasing. The src_count indices are expanded
+		// once into scratch, which holds src_count + 8 pixels, then picked.
+		static void expand_scaled_row(const std::uint8_t* src,
+		                              int src_count,
+		                              const int* x_list,
+		                              std::uint32_t* dst,
+		                              int count,
+		                              const std::uint32_t* table,
+		                              std::uint32_t* scratch);
+
+	private:
+		void update_table(const SDL_PixelFormat* format);
+
+		// Returns true if the layout changed
+		bool update_layout(const SDL_Surface* src, const SDL_Surface* dst);
+
+		void clear_borders(SDL_Surface* dst);
+
+
+
+		ThreadPool* m_thread_pool;
+		int m_color_count;
+		SDL_Color m_color_list[256];
+
+		// Native pixels of the palette colors, for the format m_table_format
+		bool m_table_valid;
+		std::uint32_t m_table_format;
+		std::uint32_t m_table[256];
+
+		// Layout of src on dst, and the source column of each visible dst column
+		ScaleMode m_scale_mode;
+		int m_layout_key[6];
+		const void* m_layout_pixels;
+		SDL_Rect m_dst_rect;
+		std::vector<int> m_x_list;
+
+		// Expanded source row, for each thread
+		std::vector<std::uint32_t> m_scratch;
+	}; // class Presenter
+} // namespace reb
+
+
+
+#endif // REBLOCHON_PRESENTER_H
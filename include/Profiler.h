@@ -0,0 +1,150 @@
+#ifndef REBLOCHON_PROFILER_H
+#define REBLOCHON_PROFILER_H
+
+#include <chrono>
+#include <cstdint>
+#include "Tracer.h"
+
+
+
+namespace reb {
+	/*
+	 * Collects the time spent in each stage of a frame, and a few counters,
+	 * then averages them over the last frames. Stages and counters are added
+	 * during a frame, and end_frame() moves on to the next frame. When given a
+	 * tracer, the timed scopes are also recorded as trace events.
+	 */
+
+	class Profiler {
+	public:
+		enum Stage {
+			EVENT_STAGE,
+			CLEAR_STAGE,
+			TRAVERSAL_STAGE,
+			COVERAGE_STAGE,
+			DRAW_STAGE,
+			TRANSPOSE_STAGE,
+			SPAN_STAGE,
+			BLIT_STAGE,
+			UPDATE_STAGE,
+			STAGE_COUNT
+		}; // enum Stage
+
+		enum Counter {
+			CELL_COUNTER,
+			FRAGMENT_COUNTER,
+			PIXEL_COUNTER,
+			COUNTER_COUNT
+		}; // enum Counter
+
+		enum { frame_count = 32 };
+
+
+
+		// Measures the time between two laps, does nothing when disabled
+		class Stopwatch {
+		public:
+			inline Stopwatch(bool enabled = true) :
+				m_enabled(enabled) {
+				if (m_enabled)
+					m_start = clock_type::now();
+			}
+
+			// Seconds since the previous lap, 0 when disabled
+			inline double
+			lap() {
+				if (!m_enabled)
+					return 0;
+
+				clock_type::time_point now = clock_type::now();
+				double time = std::chrono::duration<double>(now - m_start).count();
+				m_start = now;
+				return time;
+			}
+
+			// Time measured by a lap around nothing, the cost of reading the clock
+			static double overhead();
+
+		private:
+			typedef std::chrono::steady_clock clock_type;
+
+			bool m_enabled;
+			clock_type::time_point m_start;
+		}; // class Stopwatch
+
+
+
+		// Adds the time spent in its scope to a stage, does nothing without
+		// profiler. Meant for the main thread, thread 0 of the tracer.
+		class ScopedTimer {
+		public:
+			inline ScopedTimer(Profiler* profiler, Stage stage) :
+				m_profiler(profiler),
+				m_stage(stage),
+				m_trace_scope(profiler ? profiler->tracer() : 0, 0, name(stage)),
+				m_stopwatch(profiler != 0) { }
+
+			ScopedTimer(const ScopedTimer& other) = delete;
+
+			inline ~ScopedTimer() {
+				if (m_profiler)
+					m_profiler->add(m_stage, m_stopwatch.lap());
+			}
+
+			ScopedTimer& operator = (const ScopedTimer& other) = delete;
+
+		private:
+			Profiler* m_profiler;
+			Stage m_stage;
+			Tracer::Scope m_trace_scope;
+			Stopwatch m_stopwatch;
+		}; // class ScopedTimer
+
+
+
+		Profiler();
+
+		// Tracer receiving the timed scopes, none by default
+		inline Tracer*
+		tracer() const {
+			return m_tracer;
+		}
+
+		inline Tracer*&
+		tracer() {
+			return m_tracer;
+		}
+
+		inline void
+		add(Stage stage, double time) {
+			m_time_list[m_frame_index][stage] += time;
+		}
+
+		inline void
+		add(Counter counter, std::uint64_t count) {
+			m_count_list[m_frame_index][counter] += count;
+		}
+
+		void end_frame();
+
+		// Averages over the last completed frames, times in seconds
+		double average(Stage stage) const;
+
+		double average(Counter counter) const;
+
+		static const char* name(Stage stage);
+
+		static const char* name(Counter counter);
+
+	private:
+		Tracer* m_tracer;
+		int m_frame_index;
+		int m_completed_frame_count;
+		double m_time_list[frame_count][STAGE_COUNT];
+		std::uint64_t m_count_list[frame_count][COUNTER_COUNT];
+	}; // class Profiler
+} // namespace reb
+
+
+
+#endif // REBLOCHON_PROFILER_H
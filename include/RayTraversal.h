@@ -2,6 +2,9 @@
 #define REBLOCHON_RAY_TRAVERSAL_H
 
 #include <Eigen/Dense>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 
 
@@ -59,6 +62,14 @@ namespace reb {
 		             const Eigen::Vector2f& origin,
 		             const Eigen::Vector2f& direction);
 
+		// Setup from the precomputed reciprocal of the direction components.
+		// The initial ray parameters are still divided, so that they are
+		// exactly those of the other constructor.
+		RayTraversal(const Grid2d& grid,
+		             const Eigen::Vector2f& origin,
+		             const Eigen::Vector2f& direction,
+		             const Eigen::Vector2f& inv_direction);
+
 		inline float
 		distance_init() const {
 			return m_t_init;
@@ -112,7 +123,51 @@ namespace reb {
 			return m_index.y();
 		}
 
+		// Step of the cell index along the axis, 1, -1, or 0 if the ray never
+		// crosses that axis
+		inline int
+		index_delta(int axis) const {
+			return m_index_delta[axis];
+		}
+
+		// Number of cells left to visit, the current one included. Computed in
+		// constant time, ignoring the rounding of the ray parameters as they
+		// are stepped, thus it may be off by one for counting purposes.
+		inline int
+		remaining_count() const {
+			if (!has_next())
+				return 0;
+
+			return remaining_count(m_t, m_t_delta, m_index, m_index_delta, m_size);
+		}
+
+		// Distance at which the ray leaves the block of 2^level x 2^level cells
+		// holding the current cell
+		float block_exit_distance(int level) const;
+
+		// Moves to the first cell past the block of 2^level x 2^level cells
+		// holding the current cell, through the same cells and ray parameters
+		// as next() would, without visiting them. The distance and axis of the
+		// block exit are written to distance and axis. Returns the number of
+		// cells jumped over, the current one included.
+		int skip_block(int level, float& distance, int& axis);
+
 	private:
+		// Uninitialized, for FixedRayTraversal
+		RayTraversal() { }
+
+		void
+		block_exit(int level, int step_count[2], float t_exit[2]) const;
+
+		static int
+		remaining_count(const Eigen::Vector2f& t,
+		                const Eigen::Vector2f& t_delta,
+		                const Eigen::Vector2i& index,
+		                const Eigen::Vector2i& index_delta,
+		                const Eigen::Vector2i& size);
+
+
+
 		float m_t_init;
 		int m_axis_init;
 		Eigen::Vector2f m_t;
@@ -120,7 +175,183 @@ namespace reb {
 		Eigen::Vector2i m_size;
 		Eigen::Vector2i m_index_delta;
 		Eigen::Vector2i m_index;
+
+		friend class RayPacketTraversal;
+		friend class FixedRayTraversal;
 	}; // class RayTraversal
+
+
+
+	/*
+	 * Traversal of a packet of rays stepped together, one SIMD lane per ray.
+	 * Each lane visits exactly the same sequence of cells as a RayTraversal
+	 * would. A lane stays active until its ray leaves the grid or until it is
+	 * explicitly deactivated.
+	 */
+
+	class RayPacketTraversal {
+	public:
+		enum { size = 4 };
+
+		// Per-lane description of the cell currently crossed by each ray
+		struct HitList {
+			alignas(16) float distance[size];
+			alignas(16) int axis[size];
+			alignas(16) int i[size];
+			alignas(16) int j[size];
+		}; // struct HitList
+
+
+
+		RayPacketTraversal(const Grid2d& grid,
+		                   const Eigen::Vector2f& origin,
+		                   const Eigen::Vector2f* direction_list,
+		                   const Eigen::Vector2f* inv_direction_list);
+
+		inline float
+		distance_init(int lane) const {
+			return m_t_init[lane];
+		}
+
+		inline int
+		axis_init(int lane) const {
+			return m_axis_init[lane];
+		}
+
+		inline int
+		i(int lane) const {
+			return m_i[lane];
+		}
+
+		inline int
+		j(int lane) const {
+			return m_j[lane];
+		}
+
+		// Step of the cell index of a lane along the axis, 1, -1, or 0
+		inline int
+		index_delta(int lane, int axis) const {
+			return axis ? m_j_delta[lane] : m_i_delta[lane];
+		}
+
+		// Bit k of the mask is set when lane k is active
+		inline int
+		mask() const {
+			return m_mask;
+		}
+
+		inline void
+		deactivate(int lane) {
+			m_mask &= ~(1 << lane);
+		}
+
+		// Number of cells left to visit by a lane, the current one included
+		inline int
+		remaining_count(int lane) const {
+			if (!is_inside(lane))
+				return 0;
+
+			return RayTraversal::remaining_count(
+				Eigen::Vector2f(m_t_x[lane], m_t_y[lane]),
+				Eigen::Vector2f(m_t_delta_x[lane], m_t_delta_y[lane]),
+				Eigen::Vector2i(m_i[lane], m_j[lane]),
+				Eigen::Vector2i(m_i_delta[lane], m_j_delta[lane]),
+				Eigen::Vector2i(m_w, m_h));
+		}
+
+		inline void
+		hits(HitList& hit_list) const {
+#ifdef __SSE2__
+			__m128 t_x = _mm_load_ps(m_t_x);
+			__m128 t_y = _mm_load_ps(m_t_y);
+			__m128 axis_y = _mm_cmplt_ps(t_y, t_x);
+
+			_mm_store_ps(hit_list.distance, _mm_or_ps(_mm_and_ps(axis_y, t_y), _mm_andnot_ps(axis_y, t_x)));
+			_mm_store_si128((__m128i*)hit_list.axis, _mm_srli_epi32(_mm_castps_si128(axis_y), 31));
+			_mm_store_si128((__m128i*)hit_list.i, _mm_load_si128((const __m128i*)m_i));
+			_mm_store_si128((__m128i*)hit_list.j, _mm_load_si128((const __m128i*)m_j));
+#else
+			for(int k = 0; k < size; ++k) {
+				hit_list.axis[k] = m_t_y[k] < m_t_x[k];
+				hit_list.distance[k] = hit_list.axis[k] ? m_t_y[k] : m_t_x[k];
+				hit_list.i[k] = m_i[k];
+				hit_list.j[k] = m_j[k];
+			}
+#endif
+		}
+
+		inline void
+		next() {
+#ifdef __SSE2__
+			const __m128i lane_bits = _mm_setr_epi32(1, 2, 4, 8);
+			__m128i active = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(m_mask), lane_bits), lane_bits);
+
+			// Select the axis to step along for each active lane
+			__m128 t_x = _mm_load_ps(m_t_x);
+			__m128 t_y = _mm_load_ps(m_t_y);
+			__m128 axis_y = _mm_cmplt_ps(t_y, t_x);
+			__m128 step_y = _mm_and_ps(axis_y, _mm_castsi128_ps(active));
+			__m128 step_x = _mm_andnot_ps(axis_y, _mm_castsi128_ps(active));
+
+			// Step the ray parameters, blending rather than adding zero to keep -0 intact
+			__m128 t_x_next = _mm_add_ps(t_x, _mm_load_ps(m_t_delta_x));
+			__m128 t_y_next = _mm_add_ps(t_y, _mm_load_ps(m_t_delta_y));
+			_mm_store_ps(m_t_x, _mm_or_ps(_mm_and_ps(step_x, t_x_next), _mm_andnot_ps(step_x, t_x)));
+			_mm_store_ps(m_t_y, _mm_or_ps(_mm_and_ps(step_y, t_y_next), _mm_andnot_ps(step_y, t_y)));
+
+			// Step the cell indices
+			__m128i index_i = _mm_add_epi32(_mm_load_si128((const __m128i*)m_i), _mm_and_si128(_mm_castps_si128(step_x), _mm_load_si128((const __m128i*)m_i_delta)));
+			__m128i index_j = _mm_add_epi32(_mm_load_si128((const __m128i*)m_j), _mm_and_si128(_mm_castps_si128(step_y), _mm_load_si128((const __m128i*)m_j_delta)));
+			_mm_store_si128((__m128i*)m_i, index_i);
+			_mm_store_si128((__m128i*)m_j, index_j);
+
+			// Deactivate the lanes which left the grid
+			const __m128i minus_one = _mm_set1_epi32(-1);
+			__m128i inside = _mm_and_si128(
+				_mm_and_si128(_mm_cmpgt_epi32(index_i, minus_one), _mm_cmplt_epi32(index_i, _mm_set1_epi32(m_w))),
+				_mm_and_si128(_mm_cmpgt_epi32(index_j, minus_one), _mm_cmplt_epi32(index_j, _mm_set1_epi32(m_h))));
+			m_mask &= _mm_movemask_ps(_mm_castsi128_ps(inside));
+#else
+			for(int k = 0; k < size; ++k) {
+				if (!(m_mask & (1 << k)))
+					continue;
+
+				if (m_t_y[k] < m_t_x[k]) {
+					m_t_y[k] += m_t_delta_y[k];
+					m_j[k] += m_j_delta[k];
+				}
+				else {
+					m_t_x[k] += m_t_delta_x[k];
+					m_i[k] += m_i_delta[k];
+				}
+
+				if (!is_inside(k))
+					deactivate(k);
+			}
+#endif
+		}
+
+	private:
+		inline bool
+		is_inside(int lane) const {
+			return (m_i[lane] >= 0) and (m_i[lane] < m_w) and (m_j[lane] >= 0) and (m_j[lane] < m_h);
+		}
+
+
+
+		int m_w, m_h;
+		int m_mask;
+		float m_t_init[size];
+		int m_axis_init[size];
+		alignas(16) float m_t_x[size];
+		alignas(16) float m_t_y[size];
+		alignas(16) float m_t_delta_x[size];
+		alignas(16) float m_t_delta_y[size];
+		alignas(16) int m_i[size];
+		alignas(16) int m_j[size];
+		alignas(16) int m_i_delta[size];
+		alignas(16) int m_j_delta[size];
+	}; // class RayPacketTraversal
 } // namespace reb
 
 
@@ -3,8 +3,15 @@
 
 #include <Eigen/Geometry>
 #include "Map.h"
+#include "Profiler.h"
 #include "RayTraversal.h"
-#include <list>
+#include "FixedRayTraversal.h"
+#include "TextureAtlas.h"
+#include "ThreadPool.h"
+#include "Arena.h"
+#include "ArrayT.h"
+#include <memory>
+#include <vector>
 
 
 
@@ -45,7 +52,8 @@ namespace reb {
 			       float z_start, float z_end,
 			       float u_start, float u_end,
 			       float v_start, float v_end,
-			       unsigned int texture_id);
+			       unsigned int texture_id,
+			       std::uint32_t plane_height = 0);
 
 			inline float
 			y_start() const {
@@ -92,6 +100,12 @@ namespace reb {
 				return m_texture_id;
 			}
 
+			// Height of the plane holding a floor or ceiling fragment, in map units
+			inline std::uint32_t
+			plane_height() const {
+				return m_plane_height;
+			}
+
 			void
 			clip(float y_lo, float y_hi);
 
@@ -101,40 +115,315 @@ namespace reb {
 			float m_u_start, m_u_end;
 			float m_v_start, m_v_end;
 			unsigned int m_texture_id;
+			std::uint32_t m_plane_height;
 		}; // class Column
 
 
 
-		// Represents a full column of the screen
+		// Represents a full column of the screen. Storage is taken from an arena,
+		// sized from the height of the column, so that clearing the buffer and
+		// adding fragments never allocates.
 		class CoverageBuffer {
 		public:
-			typedef std::list<Column> column_list_type;
-			typedef std::list<IntegerRange> integer_range_list_type;
+			typedef const Column* const_iterator;
+
 
 
+			CoverageBuffer(int size, Arena& arena);
 
-			CoverageBuffer(int size);
+			// Arena bytes needed by a buffer for a column of the given size
+			static Arena::size_type footprint(int size);
 
-			inline const column_list_type&
-			column_list() const {
+			// Iterates over the column fragments added so far
+			inline const_iterator
+			begin() const {
 				return m_column_list;
 			}
 
+			inline const_iterator
+			end() const {
+				return m_column_list + m_column_count;
+			}
+
+			// True once every pixel of the column is covered
+			inline bool
+			is_complete() const {
+				return m_unoccluded_range_count == 0;
+			}
+
+			// Bottom end of the lowest unoccluded range, 0 once the column is complete
+			inline int
+			unoccluded_end() const {
+				return m_unoccluded_range_count ? m_unoccluded_range_list[m_unoccluded_range_count - 1].end() : 0;
+			}
+
+			// When timed, the time spent adding fragments is accumulated
+			inline bool
+			timed() const {
+				return m_timed;
+			}
+
+			inline bool&
+			timed() {
+				return m_timed;
+			}
+
+			inline double
+			add_time() const {
+				return m_add_time;
+			}
+
+			inline double&
+			add_time() {
+				return m_add_time;
+			}
+
 			void clear();
 
-			void add(Column& column);
+			inline void
+			add(Column& column) {
+				if (!m_timed) {
+					insert(column);
+					return;
+				}
+
+				Profiler::Stopwatch stopwatch;
+				insert(column);
+				m_add_time += stopwatch.lap() - Profiler::Stopwatch::overhead();
+			}
 
 		private:
+			void insert(Column& column);
+
+
+
 			int m_size;
-			column_list_type m_column_list;
-			integer_range_list_type m_unoccluded_range_list;
+			bool m_timed;
+			double m_add_time;
+
+			// At most 2 * m_size fragments : one per newly occluded pixel, plus
+			// one per empty fragment splitting an unoccluded range
+			int m_column_count;
+			Column* m_column_list;
+
+			// Sorted, disjoint and non-empty ranges, thus at most m_size of them
+			int m_unoccluded_range_count;
+			IntegerRange* m_unoccluded_range_list;
 		}; // class CoverageBuffer
 
 
 
+		// Counters gathered while rendering a frame
+		class Stats {
+		public:
+			Stats();
+
+			// Cells left untraversed thanks to rays stopping on complete columns
+			inline std::uint64_t
+			skipped_cell_count() const {
+				return m_skipped_cell_count;
+			}
+
+			inline std::uint64_t&
+			skipped_cell_count() {
+				return m_skipped_cell_count;
+			}
+
+			// Cells jumped over thanks to the max height pyramid of the map
+			inline std::uint64_t
+			jumped_cell_count() const {
+				return m_jumped_cell_count;
+			}
+
+			inline std::uint64_t&
+			jumped_cell_count() {
+				return m_jumped_cell_count;
+			}
+
+			inline std::uint64_t
+			traversed_cell_count() const {
+				return m_traversed_cell_count;
+			}
+
+			inline std::uint64_t&
+			traversed_cell_count() {
+				return m_traversed_cell_count;
+			}
+
+			// Column fragments left after occlusion
+			inline std::uint64_t
+			fragment_count() const {
+				return m_fragment_count;
+			}
+
+			inline std::uint64_t&
+			fragment_count() {
+				return m_fragment_count;
+			}
+
+			inline std::uint64_t
+			pixel_count() const {
+				return m_pixel_count;
+			}
+
+			inline std::uint64_t&
+			pixel_count() {
+				return m_pixel_count;
+			}
+
+			// Time spent in a stage of the renderer, in seconds, only measured
+			// when the renderer has a profiler
+			inline double
+			time(Profiler::Stage stage) const {
+				return m_time_list[stage];
+			}
+
+			inline double&
+			time(Profiler::Stage stage) {
+				return m_time_list[stage];
+			}
+
+			void clear();
+
+			Stats& operator += (const Stats& other);
+
+		private:
+			std::uint64_t m_skipped_cell_count;
+			std::uint64_t m_jumped_cell_count;
+			std::uint64_t m_traversed_cell_count;
+			std::uint64_t m_fragment_count;
+			std::uint64_t m_pixel_count;
+			double m_time_list[Profiler::STAGE_COUNT];
+		}; // class Stats
+
+
+
+		// How floors and ceilings are drawn
+		enum FloorMode {
+			// Column by column, along with the walls
+			COLUMN_FLOOR_MODE,
+
+			// Row by row, in a separate pass, as planes have a constant depth per row
+			SCANLINE_FLOOR_MODE
+		}; // enum FloorMode
+
+
+
+		// How texture coordinates are stepped by the column drawing kernels
+		enum KernelMode {
+			// In floating point, converted to texel offsets at each pixel. Reference.
+			FLOAT_KERNEL_MODE,
+
+			// In 16.16 fixed point, one integer add and a mask per pixel
+			FIXED_KERNEL_MODE
+		}; // enum KernelMode
+
+
+
 		Renderer(int w, int h,
 		         SDL_Surface* texture_atlas,
-		         float focal_length);
+		         float focal_length,
+		         int thread_count = 1);
+
+		inline int
+		width() const {
+			return m_w;
+		}
+
+		inline int
+		height() const {
+			return m_h;
+		}
+
+		// Changes the size of the rendered frames, the per-column setup and the
+		// frame buffers are only rebuilt when the size actually changes
+		void resize(int w, int h);
+
+		inline int
+		thread_count() const {
+			return m_thread_pool.size();
+		}
+
+		// The rendering threads, idle outside of render()
+		inline ThreadPool&
+		thread_pool() {
+			return m_thread_pool;
+		}
+
+		// Counters of the last rendered frame
+		inline const Stats&
+		stats() const {
+			return m_stats;
+		}
+
+		// When enabled, rays of adjacent columns are traversed by packets
+		inline bool
+		packet_traversal() const {
+			return m_packet_traversal;
+		}
+
+		inline bool&
+		packet_traversal() {
+			return m_packet_traversal;
+		}
+
+		inline FloorMode
+		floor_mode() const {
+			return m_floor_mode;
+		}
+
+		inline FloorMode&
+		floor_mode() {
+			return m_floor_mode;
+		}
+
+		inline KernelMode
+		kernel_mode() const {
+			return m_kernel_mode;
+		}
+
+		inline KernelMode&
+		kernel_mode() {
+			return m_kernel_mode;
+		}
+
+		// Jump over the blocks of cells hidden behind what is already drawn,
+		// when the map provides a max height pyramid. Scalar traversal only.
+		inline bool
+		empty_space_skipping() const {
+			return m_empty_space_skipping;
+		}
+
+		inline bool&
+		empty_space_skipping() {
+			return m_empty_space_skipping;
+		}
+
+		// Column floors : perspective-correct texture coordinates are computed
+		// every floor_subdivision() pixels and interpolated linearly in between.
+		// 0 or 1 selects the exact, per pixel computation.
+		inline int
+		floor_subdivision() const {
+			return m_floor_subdivision;
+		}
+
+		inline int&
+		floor_subdivision() {
+			return m_floor_subdivision;
+		}
+
+		// Profiler receiving the stage times and the counters of each frame,
+		// averaged over the threads, none by default. The stages of each thread
+		// are recorded by the tracer of the profiler, if any.
+		inline Profiler*
+		profiler() const {
+			return m_profiler;
+		}
+
+		inline Profiler*&
+		profiler() {
+			return m_profiler;
+		}
 
 		void
 		render(SDL_Surface* dst,
@@ -144,28 +433,139 @@ namespace reb {
 
 		static float focal_length_from_angle(float angle);
 
+		// Draw kernels, dst points to the first pixel of a column. Exposed so
+		// that they can be measured in isolation.
+
+		void draw_wall_column(std::uint8_t* dst, const Column& column);
+
+		void draw_floor_column(std::uint8_t* dst, const Column& column);
+
+		void draw_wall_column_fixed(std::uint8_t* dst, const Column& column);
+
+		// Fixed point stepping only applies between the perspective corrected
+		// points, exact floors use draw_floor_column()
+		void draw_floor_column_fixed(std::uint8_t* dst, const Column& column);
+
 	private:
+		// Traversal of the rays which are not traversed by packets
+#ifdef REBLOCHON_FIXED_POINT_TRAVERSAL
+		typedef FixedRayTraversal traversal_type;
+#else
+		typedef RayTraversal traversal_type;
+#endif
+
+
+
+		void render_column_band(SDL_Surface* dst,
+		                        CoverageBuffer* coverage_buffer_list,
+		                        Stats& stats,
+		                        int thread_index,
+		                        int i_start, int i_end,
+		                        const Map& map,
+		                        const Grid2d& grid,
+		                        const Eigen::Matrix2f& rot_offset,
+		                        const Eigen::Vector2f& ray_pos,
+		                        float view_height);
+
+		void rotate_ray_band(const Eigen::Matrix2f& rot_offset, int i_start, int i_end);
+
 		void fill_coverage_buffer(CoverageBuffer& coverage_buffer,
+		                          Stats& stats,
 		                          const Map& map,
                               const Grid2d& grid,
 		                          const Eigen::Vector2f& ray_pos,
                               const Eigen::Vector2f& ray_dir,
+		                          const Eigen::Vector2f& inv_ray_dir,
 		                          float ray_norm,
                               float view_height);
 
-		void draw_column(SDL_Surface* dst, int x, const Column& column);
-
-		void draw_wall_column(SDL_Surface* dst, int x, const Column& column);
-
-		void draw_floor_column(SDL_Surface* dst, int x, const Column& column);
+		void fill_coverage_buffer_packet(CoverageBuffer* coverage_buffer_list,
+		                                 Stats& stats,
+		                                 const Map& map,
+		                                 const Grid2d& grid,
+		                                 const Eigen::Vector2f& ray_pos,
+		                                 const Eigen::Vector2f* ray_dir_list,
+		                                 const Eigen::Vector2f* inv_ray_dir_list,
+		                                 const float* ray_norm_list,
+		                                 float view_height);
+
+		int hidden_block_level(const Map& map,
+		                       const traversal_type& traversal,
+		                       float hidden_distance,
+		                       float view_height) const;
+
+		void add_origin_cell_fragments(CoverageBuffer& coverage_buffer,
+		                               const Map::Cell& cell,
+		                               const Eigen::Vector2f& ray_pos,
+		                               const Eigen::Vector2f& ray_dir,
+		                               float ray_norm,
+		                               float view_height,
+		                               float prev_dist,
+		                               int prev_axis);
+
+		void add_cell_fragments(CoverageBuffer& coverage_buffer,
+		                        const Map::Cell& cell,
+		                        const Eigen::Vector2f& ray_pos,
+		                        const Eigen::Vector2f& ray_dir,
+		                        float ray_norm,
+		                        float view_height,
+		                        float prev_dist,
+		                        int prev_axis,
+		                        float dist,
+		                        int axis);
+
+		void render_span_band(SDL_Surface* dst,
+		                      Stats& stats,
+		                      int j_start, int j_end,
+		                      const Map& map,
+		                      const Grid2d& grid,
+		                      const Eigen::Matrix2f& rot_offset,
+		                      const Eigen::Vector2f& ray_pos,
+		                      float view_height);
+
+		void transpose_column_band(SDL_Surface* dst, int i_start, int i_end);
+
+		inline std::uint8_t*
+		column_pixels(int i) {
+			return m_column_buffer.data() + i * m_h;
+		}
+
+		// Returns the number of pixels written
+		int draw_column(int x, const Column& column);
+
+		void mark_plane_column(int x, const Column& column);
 
 		void setup();
 
 	
 		int m_w, m_h;
 		float m_focal_length;
-		SDL_Surface* m_texture_atlas;
+		bool m_packet_traversal;
+		FloorMode m_floor_mode;
+		KernelMode m_kernel_mode;
+		bool m_empty_space_skipping;
+		int m_floor_subdivision;
+		Profiler* m_profiler;
+		TextureAtlas m_texture_atlas;
 		Eigen::Matrix<float, Eigen::Dynamic, 3> m_ray_direction_list;
+
+		// Ray directions of each column rotated for the current frame, and their
+		// reciprocals, one array per component
+		ArrayT<float> m_ray_dir_x, m_ray_dir_y;
+		ArrayT<float> m_inv_ray_dir_x, m_inv_ray_dir_y;
+
+		// Render target, stored column by column
+		ArrayT<std::uint8_t> m_column_buffer;
+
+		// Scanline floor mode : plane height + 1 of each floor pixel, row by row
+		ArrayT<std::uint32_t> m_plane_buffer;
+
+		ThreadPool m_thread_pool;
+
+		// Transient storage of each thread, released at the start of each frame
+		std::vector<std::unique_ptr<Arena>> m_arena_list;
+		std::vector<Stats> m_thread_stats_list;
+		Stats m_stats;
 	}; //  class Renderer
 } // namespace reb
 
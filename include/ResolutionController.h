@@ -0,0 +1,83 @@
+#ifndef REBLOCHON_RESOLUTION_CONTROLLER_H
+#define REBLOCHON_RESOLUTION_CONTROLLER_H
+
+
+
+namespace reb {
+	/*
+	 * Picks the size of the rendered frames to hold a target rendering time.
+	 * The rendering time of each frame is fed to the controller, which scales
+	 * a maximum size down when the frames are too slow, and back up when there
+	 * is room to spare. The cost of a frame is assumed to grow with its number
+	 * of pixels, the aspect ratio is kept, and the width stays a multiple of
+	 * the size of a ray packet. After each change, the controller waits for a
+	 * few frames at the new size before deciding again.
+	 */
+
+	class ResolutionController {
+	public:
+		enum {
+			// Frames rendered at a new size before it is judged
+			settle_frame_count = 8
+		};
+
+
+
+		ResolutionController(int max_w, int max_h, double target_time);
+
+		inline int
+		width() const {
+			return m_w;
+		}
+
+		inline int
+		height() const {
+			return m_h;
+		}
+
+		// Target rendering time of a frame, in seconds
+		inline double
+		target_time() const {
+			return m_target_time;
+		}
+
+		inline double&
+		target_time() {
+			return m_target_time;
+		}
+
+		// Smallest fraction of the maximum size, in ]0, 1]
+		inline float
+		min_scale() const {
+			return m_min_scale;
+		}
+
+		inline float&
+		min_scale() {
+			return m_min_scale;
+		}
+
+		// Feeds the rendering time of a frame, returns true if the size changed
+		bool update(double frame_time);
+
+	private:
+		void set_scale(float scale);
+
+
+
+		int m_max_w, m_max_h;
+		double m_target_time;
+		float m_min_scale;
+
+		float m_scale;
+		int m_w, m_h;
+
+		// Frame times since the last change
+		int m_frame_count;
+		double m_average_time;
+	}; // class ResolutionController
+} // namespace reb
+
+
+
+#endif // REBLOCHON_RESOLUTION_CONTROLLER_H
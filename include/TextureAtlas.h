@@ -0,0 +1,50 @@
+#ifndef REBLOCHON_TEXTURE_ATLAS_H
+#define REBLOCHON_TEXTURE_ATLAS_H
+
+#include <SDL.h>
+#include <cstdint>
+#include "ArrayT.h"
+
+
+
+namespace reb {
+	/*
+	 * Atlas of 16x16 textures, converted from an 8 bits indexed colors surface
+	 * where the textures are laid out on a grid. Each texture is stored as one
+	 * contiguous block of 256 texels, column by column : texel (u, v) is at
+	 * offset 16 * u + v, thus a wall column samples contiguous texels.
+	 */
+
+	class TextureAtlas {
+	public:
+		enum {
+			texture_size = 16,
+			texel_count = texture_size * texture_size,
+			max_texture_count = 256
+		};
+
+
+
+		TextureAtlas(const SDL_Surface* surface);
+
+		inline int
+		texture_count() const {
+			return m_texture_count;
+		}
+
+		// Texture ids beyond the number of textures wrap around
+		inline const std::uint8_t*
+		texture(unsigned int texture_id) const {
+			return m_texture_list[texture_id & (max_texture_count - 1)];
+		}
+
+	private:
+		int m_texture_count;
+		ArrayT<std::uint8_t> m_texel_list;
+		const std::uint8_t* m_texture_list[max_texture_count];
+	}; // class TextureAtlas
+} // namespace reb
+
+
+
+#endif // REBLOCHON_TEXTURE_ATLAS_H
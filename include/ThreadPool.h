@@ -0,0 +1,73 @@
+#ifndef REBLOCHON_THREAD_POOL_H
+#define REBLOCHON_THREAD_POOL_H
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+
+namespace reb {
+	/*
+	 * Persistent pool of worker threads. A task is run once on each thread of
+	 * the pool, the thread index being passed to the task. The calling thread
+	 * takes part to the work as the thread of index 0, thus a pool of size 1
+	 * does not spawn any thread.
+	 */
+
+	class ThreadPool {
+	public:
+		ThreadPool(int thread_count);
+
+		ThreadPool(const ThreadPool& other) = delete;
+
+		~ThreadPool();
+
+		ThreadPool& operator = (const ThreadPool& other) = delete;
+
+		inline int
+		size() const {
+			return m_thread_count;
+		}
+
+		// Calls task(k) for k in [0, size()[, returns once all the calls are done
+		template <class F>
+		inline void
+		run(F& task) {
+			dispatch(&ThreadPool::trampoline<F>, &task);
+		}
+
+	private:
+		typedef void (*task_func_type)(void*, int);
+
+		template <class F>
+		static void
+		trampoline(void* task, int thread_index) {
+			(*static_cast<F*>(task))(thread_index);
+		}
+
+		void dispatch(task_func_type task_func, void* task_data);
+
+		void worker_loop(int thread_index);
+
+
+
+		int m_thread_count;
+		std::vector<std::thread> m_thread_list;
+
+		std::mutex m_mutex;
+		std::condition_variable m_start_cond;
+		std::condition_variable m_done_cond;
+		unsigned int m_generation;
+		int m_pending_count;
+		bool m_quit;
+
+		task_func_type m_task_func;
+		void* m_task_data;
+	}; // class ThreadPool
+} // namespace reb
+
+
+
+#endif // REBLOCHON_THREAD_POOL_H
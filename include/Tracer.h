@@ -0,0 +1,112 @@
+#ifndef REBLOCHON_TRACER_H
+#define REBLOCHON_TRACER_H
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "ArrayT.h"
+
+
+
+namespace reb {
+	/*
+	 * Records timestamped begin and end events, one ring buffer per thread so
+	 * that threads never contend, keeping only the most recent events. The
+	 * events can be saved in the Chrome trace event format, for chrome://tracing
+	 * or Perfetto. Event names are not copied, they should be string literals.
+	 */
+
+	class Tracer {
+	public:
+		// Emits a begin event, then an end event when leaving its scope
+		class Scope {
+		public:
+			inline Scope(Tracer* tracer, int thread_index, const char* name) :
+				m_tracer(tracer),
+				m_thread_index(thread_index),
+				m_name(name) {
+				if (m_tracer)
+					m_tracer->begin(m_thread_index, m_name);
+			}
+
+			Scope(const Scope& other) = delete;
+
+			inline ~Scope() {
+				if (m_tracer)
+					m_tracer->end(m_thread_index, m_name);
+			}
+
+			Scope& operator = (const Scope& other) = delete;
+
+		private:
+			Tracer* m_tracer;
+			int m_thread_index;
+			const char* m_name;
+		}; // class Scope
+
+
+
+		// Records up to capacity events per thread
+		Tracer(int thread_count, std::size_t capacity = 1 << 16);
+
+		Tracer(const Tracer& other) = delete;
+
+		Tracer& operator = (const Tracer& other) = delete;
+
+		inline void
+		begin(int thread_index, const char* name) {
+			record(thread_index, name, 'B');
+		}
+
+		inline void
+		end(int thread_index, const char* name) {
+			record(thread_index, name, 'E');
+		}
+
+		bool save(const char* path) const;
+
+	private:
+		typedef std::chrono::steady_clock clock_type;
+
+		struct Event {
+			const char* name;
+			std::int64_t time;
+			char phase;
+		}; // struct Event
+
+		struct Ring {
+			Ring(std::size_t capacity) :
+				event_count(0),
+				event_list(capacity) { }
+
+			std::size_t event_count;
+			ArrayT<Event> event_list;
+		}; // struct Ring
+
+		inline void
+		record(int thread_index, const char* name, char phase) {
+			if ((thread_index < 0) or (thread_index >= int(m_ring_list.size())) or (m_capacity == 0))
+				return;
+
+			Ring& ring = *m_ring_list[thread_index];
+			Event& event = ring.event_list[ring.event_count % m_capacity];
+			event.name = name;
+			event.time = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - m_start).count();
+			event.phase = phase;
+			ring.event_count += 1;
+		}
+
+
+
+		std::size_t m_capacity;
+		clock_type::time_point m_start;
+
+		// Allocated separately, so that threads do not share cache lines
+		std::vector<std::unique_ptr<Ring>> m_ring_list;
+	}; // class Tracer
+} // namespace reb
+
+
+
+#endif // REBLOCHON_TRACER_H
@@ -0,0 +1,73 @@
+#ifdef REBLOCHON_ALLOCATION_CHECK
+#include "AllocationCounter.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+using namespace reb;
+
+
+
+static std::atomic<std::uint64_t> allocation_count(0);
+
+
+
+std::uint64_t
+AllocationCounter::count() {
+	return allocation_count.load(std::memory_order_relaxed);
+}
+
+
+
+// --- Global new and delete operators ----------------------------------------
+
+void*
+operator new(std::size_t size) {
+	allocation_count.fetch_add(1, std::memory_order_relaxed);
+
+	void* ptr = std::malloc(size ? size : 1);
+	if (!ptr)
+		throw std::bad_alloc();
+
+	return ptr;
+}
+
+
+
+void*
+operator new[](std::size_t size) {
+	return operator new(size);
+}
+
+
+
+void
+operator delete(void* ptr) noexcept {
+	if (!ptr)
+		return;
+
+	allocation_count.fetch_add(1, std::memory_order_relaxed);
+	std::free(ptr);
+}
+
+
+
+void
+operator delete[](void* ptr) noexcept {
+	operator delete(ptr);
+}
+
+
+
+void
+operator delete(void* ptr, std::size_t) noexcept {
+	operator delete(ptr);
+}
+
+
+
+void
+operator delete[](void* ptr, std::size_t) noexcept {
+	operator delete(ptr);
+}
+#endif // REBLOCHON_ALLOCATION_CHECK
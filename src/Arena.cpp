@@ -0,0 +1,9 @@
+#include "Arena.h"
+
+using namespace reb;
+
+
+
+Arena::Arena(size_type capacity) :
+	m_buffer(capacity),
+	m_used(0) { }
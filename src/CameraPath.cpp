@@ -0,0 +1,86 @@
+#include <SDL.h>
+#include <cstdio>
+#include <algorithm>
+#include "CameraPath.h"
+
+using namespace reb;
+
+
+
+CameraPath::Pose
+CameraPath::interpolate(float s) const {
+	if (m_pose_list.empty())
+		return Pose();
+
+	// Locate the segment of the path holding s
+	float x = std::min(std::max(s, 0.f), 1.f) * (m_pose_list.size() - 1);
+	std::size_t k = std::min(std::size_t(x), m_pose_list.size() - 1);
+	if (k + 1 == m_pose_list.size())
+		return m_pose_list.back();
+
+	// Linear interpolation along the segment
+	float t = x - k;
+	const Pose& a = m_pose_list[k];
+	const Pose& b = m_pose_list[k + 1];
+	return Pose((1 - t) * a.pos() + t * b.pos(), (1 - t) * a.angle() + t * b.angle());
+}
+
+
+
+bool
+CameraPath::save(const char* path) const {
+	FILE* file = fopen(path, "w");
+	if (!file) {
+		SDL_SetError("could not open '%s' for writing", path);
+		return false;
+	}
+
+	for(const Pose& pose : m_pose_list)
+		fprintf(file, "%.9g %.9g %.9g %.9g\n", pose.pos().x(), pose.pos().y(), pose.pos().z(), pose.angle());
+
+	if (fclose(file) != 0) {
+		SDL_SetError("could not write '%s'", path);
+		return false;
+	}
+
+	// Job done
+	return true;
+}
+
+
+
+bool
+CameraPath::load(const char* path, CameraPath& camera_path) {
+	FILE* file = fopen(path, "r");
+	if (!file) {
+		SDL_SetError("could not open '%s' for reading", path);
+		return false;
+	}
+
+	// Read one pose per line
+	std::vector<Pose> pose_list;
+	while(true) {
+		float x, y, z, angle;
+		int read_count = fscanf(file, "%f %f %f %f", &x, &y, &z, &angle);
+		if (read_count == EOF)
+			break;
+
+		if (read_count != 4) {
+			SDL_SetError("malformed pose at line %d", int(pose_list.size()) + 1);
+			fclose(file);
+			return false;
+		}
+
+		pose_list.push_back(Pose(Eigen::Vector3f(x, y, z), angle));
+	}
+	fclose(file);
+
+	if (pose_list.empty()) {
+		SDL_SetError("empty camera path");
+		return false;
+	}
+
+	// Job done
+	camera_path.pose_list() = pose_list;
+	return true;
+}
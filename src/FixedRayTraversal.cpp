@@ -0,0 +1,139 @@
+#include "FixedRayTraversal.h"
+#include <cmath>
+#include <limits>
+
+using namespace reb;
+
+
+
+namespace {
+	// Stands for an infinite ray parameter, far beyond any grid, low enough
+	// for two of them to be added without overflow
+	const FixedRayTraversal::fixed_type fixed_infinity = FixedRayTraversal::fixed_type(1) << 61;
+} // namespace
+
+
+
+FixedRayTraversal::FixedRayTraversal(const Grid2d& grid,
+                                     const Eigen::Vector2f& origin,
+                                     const Eigen::Vector2f& direction) {
+	init(RayTraversal(grid, origin, direction));
+}
+
+
+
+FixedRayTraversal::FixedRayTraversal(const Grid2d& grid,
+                                     const Eigen::Vector2f& origin,
+                                     const Eigen::Vector2f& direction,
+                                     const Eigen::Vector2f& inv_direction) {
+	init(RayTraversal(grid, origin, direction, inv_direction));
+}
+
+
+
+int
+FixedRayTraversal::remaining_count() const {
+	return to_ray_traversal().remaining_count();
+}
+
+
+
+float
+FixedRayTraversal::block_exit_distance(int level) const {
+	// Called for every cell when skipping empty space, thus not delegated
+	float t_exit[2];
+	for(int i = 0; i < 2; ++i) {
+		if (m_index_delta[i] == 0)
+			t_exit[i] = std::numeric_limits<float>::infinity();
+		else {
+			int block_start = (m_index[i] >> level) << level;
+			int step_count = m_index_delta[i] > 0 ? block_start + (1 << level) - m_index[i] : m_index[i] - block_start + 1;
+			// Adding zero turns -0 into 0, as the floating point traversal does
+			if (step_count == 1)
+				t_exit[i] = ray_parameter(i) + 0.f;
+			else {
+				fixed_type t = step(m_t[i], step_count - 1, m_t_delta[i]);
+				t_exit[i] = t >= fixed_infinity ? std::numeric_limits<float>::infinity() : to_float(t);
+			}
+		}
+	}
+
+	return t_exit[1] < t_exit[0] ? t_exit[1] : t_exit[0];
+}
+
+
+
+int
+FixedRayTraversal::skip_block(int level, float& distance, int& axis) {
+	RayTraversal traversal = to_ray_traversal();
+	int jumped_count = traversal.skip_block(level, distance, axis);
+	init(traversal);
+
+	return jumped_count;
+}
+
+
+
+FixedRayTraversal::fixed_type
+FixedRayTraversal::to_fixed(float x) {
+	// Scaling by a power of 2 is exact, as is the conversion of the result
+	float scaled = std::ldexp(x, fraction_bits);
+	if (!(scaled < float(fixed_infinity)))
+		return fixed_infinity;
+	if (!(scaled > -float(fixed_infinity)))
+		return -fixed_infinity;
+
+	return fixed_type(scaled);
+}
+
+
+
+FixedRayTraversal::fixed_type
+FixedRayTraversal::step(fixed_type t, int count, fixed_type t_delta) {
+	if (t_delta >= fixed_infinity / count)
+		return fixed_infinity;
+
+	fixed_type sum = t + round(count * t_delta);
+	return sum >= fixed_infinity ? fixed_infinity : round(sum);
+}
+
+
+
+void
+FixedRayTraversal::init(const RayTraversal& traversal) {
+	m_t_init = traversal.m_t_init;
+	m_axis_init = traversal.m_axis_init;
+
+	for(int i = 0; i < 2; ++i) {
+		m_t[i] = to_fixed(traversal.m_t[i]);
+		m_small_t[i] = traversal.m_t[i];
+		m_t_delta[i] = to_fixed(traversal.m_t_delta[i]);
+		m_size[i] = traversal.m_size[i];
+		m_index_delta[i] = traversal.m_index_delta[i];
+		m_index[i] = traversal.m_index[i];
+	}
+
+	// The small ray parameters are only ordered exactly as floats
+	m_axis = traversal.m_t[1] < traversal.m_t[0];
+}
+
+
+
+RayTraversal
+FixedRayTraversal::to_ray_traversal() const {
+	const float infinity = std::numeric_limits<float>::infinity();
+
+	RayTraversal traversal;
+	traversal.m_t_init = m_t_init;
+	traversal.m_axis_init = m_axis_init;
+
+	for(int i = 0; i < 2; ++i) {
+		traversal.m_t[i] = m_t[i] >= fixed_infinity ? infinity : ray_parameter(i);
+		traversal.m_t_delta[i] = m_t_delta[i] >= fixed_infinity ? infinity : to_float(m_t_delta[i]);
+		traversal.m_size[i] = m_size[i];
+		traversal.m_index_delta[i] = m_index_delta[i];
+		traversal.m_index[i] = m_index[i];
+	}
+
+	return traversal;
+}
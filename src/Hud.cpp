@@ -0,0 +1,135 @@
+#include "Hud.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+
+using namespace reb;
+
+
+
+namespace reb {
+namespace internals {
+	const int glyph_w = 3;
+	const int glyph_h = 5;
+	const int text_scale = 2;
+
+	/*
+	 * 3x5 glyphs, one bit per pixel, row by row from the top, the most
+	 * significant bit of each row being the leftmost pixel
+	 */
+
+	const char glyph_char_list[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ.:/%-";
+
+	const std::uint16_t glyph_list[] = {
+		075557, 026227, 071747, 071717, 055711, 074717, 074757, 071111, 075757, 075717,
+		025755, 065656, 034443, 065556, 074647, 074644, 034553, 055755, 072227, 011152,
+		055655, 044447, 057755, 065555, 025552, 065644, 025563, 065655, 034216, 072222,
+		055557, 055552, 055775, 055255, 055222, 071247, 000002, 002020, 011244, 051245,
+		000700
+	};
+
+	std::uint16_t
+	glyph(char c) {
+		const char* match = strchr(glyph_char_list, toupper(c));
+		if ((c == '\0') or !match)
+			return 0;
+
+		return glyph_list[match - glyph_char_list];
+	}
+
+
+
+	// Index of the palette color closest to the given color
+	std::uint8_t
+	closest_color(const SDL_Palette* palette, int r, int g, int b) {
+		int best_index = 0;
+		int best_dist = -1;
+		for(int k = 0; k < palette->ncolors; ++k) {
+			const SDL_Color& color = palette->colors[k];
+			int dist = (color.r - r) * (color.r - r) + (color.g - g) * (color.g - g) + (color.b - b) * (color.b - b);
+			if ((best_dist < 0) or (dist < best_dist)) {
+				best_index = k;
+				best_dist = dist;
+			}
+		}
+
+		return best_index;
+	}
+} // namespace internals
+} // namespace reb
+
+
+
+Hud::Hud(const SDL_Palette* palette) :
+	m_text_color(255),
+	m_background_color(0) {
+	if (palette and (palette->ncolors > 0)) {
+		m_text_color = internals::closest_color(palette, 255, 255, 255);
+		m_background_color = internals::closest_color(palette, 0, 0, 0);
+	}
+}
+
+
+
+void
+Hud::draw(SDL_Surface* dst, const Profiler& profiler) const {
+	const int line_h = (internals::glyph_h + 2) * internals::text_scale;
+	const int char_w = (internals::glyph_w + 1) * internals::text_scale;
+	const int margin = 2 * internals::text_scale;
+	const int column_count = 24;
+	const int line_count = Profiler::STAGE_COUNT + Profiler::COUNTER_COUNT + 1;
+
+	// Background
+	fill_rect(dst, 0, 0, column_count * char_w + 2 * margin, line_count * line_h + 2 * margin, m_background_color);
+
+	// Stage times, and their sum
+	char line[column_count + 1];
+	int y = margin;
+	double total = 0;
+	for(int stage = 0; stage < Profiler::STAGE_COUNT; ++stage, y += line_h) {
+		double time = profiler.average(Profiler::Stage(stage));
+		total += time;
+
+		snprintf(line, sizeof(line), "%-10s %8.3f MS", Profiler::name(Profiler::Stage(stage)), 1e3 * time);
+		draw_text(dst, margin, y, line);
+	}
+
+	snprintf(line, sizeof(line), "%-10s %8.3f MS", "total", 1e3 * total);
+	draw_text(dst, margin, y, line);
+	y += line_h;
+
+	// Counters
+	for(int counter = 0; counter < Profiler::COUNTER_COUNT; ++counter, y += line_h) {
+		snprintf(line, sizeof(line), "%-10s %11.0f", Profiler::name(Profiler::Counter(counter)), profiler.average(Profiler::Counter(counter)));
+		draw_text(dst, margin, y, line);
+	}
+}
+
+
+
+void
+Hud::draw_text(SDL_Surface* dst, int x, int y, const char* text) const {
+	const int s = internals::text_scale;
+
+	for( ; *text; ++text, x += (internals::glyph_w + 1) * s) {
+		std::uint16_t glyph = internals::glyph(*text);
+		for(int j = 0; j < internals::glyph_h; ++j)
+			for(int i = 0; i < internals::glyph_w; ++i)
+				if (glyph & (1 << ((internals::glyph_h - 1 - j) * internals::glyph_w + (internals::glyph_w - 1 - i))))
+					fill_rect(dst, x + i * s, y + j * s, s, s, m_text_color);
+	}
+}
+
+
+
+void
+Hud::fill_rect(SDL_Surface* dst, int x, int y, int w, int h, std::uint8_t color) const {
+	int x_start = std::max(x, 0), x_end = std::min(x + w, dst->w);
+	int y_start = std::max(y, 0), y_end = std::min(y + h, dst->h);
+
+	for(int j = y_start; j < y_end; ++j) {
+		std::uint8_t* row = (std::uint8_t*)dst->pixels + j * dst->pitch;
+		std::fill(row + x_start, row + x_end, color);
+	}
+}
@@ -2,12 +2,19 @@
 #include "Map.h"
 #include "LoadPNG.h"
 #include "Renderer.h"
+#include "CameraPath.h"
+#include "Hud.h"
+#include "Presenter.h"
+#include "ResolutionController.h"
+#include "Profiler.h"
+#include "Tracer.h"
 #include "Macros.h"
 #include "cxxopts.h"
 #include <iostream>
 
 using namespace reb;
 
+// Default rendering resolution, and smallest window size
 const unsigned int SCREEN_WIDTH  = 640;
 const unsigned int SCREEN_HEIGHT = 480;
 
@@ -86,11 +93,31 @@ private:
 struct Settings {
 	Settings() :
 		fullscreen(false),
-		fov(60) { }
+		width(SCREEN_WIDTH),
+		height(SCREEN_HEIGHT),
+		scale_mode("integer"),
+		target_frame_time(0),
+		fov(60),
+		thread_count(1),
+		packet_traversal(false),
+		scanline_floors(false),
+		floor_subdivision(0),
+		fixed_kernels(false) { }
 
 	std::string path;
+	std::string record_path;
+	std::string trace_path;
 	bool fullscreen;
+	unsigned int width;
+	unsigned int height;
+	std::string scale_mode;
+	float target_frame_time;
 	unsigned int fov;	
+	unsigned int thread_count;
+	bool packet_traversal;
+	bool scanline_floors;
+	unsigned int floor_subdivision;
+	bool fixed_kernels;
 }; // struct Settings
 
 
@@ -103,8 +130,19 @@ parse(int argc, char* argv[], Settings& settings) {
 			.allow_unrecognised_options()
 			.add_options()
       ("f, fullscreen", "fullscreen display mode", cxxopts::value<bool>(settings.fullscreen))
+      ("width", "width of the rendered frames", cxxopts::value<unsigned int>(settings.width), "N")
+      ("height", "height of the rendered frames", cxxopts::value<unsigned int>(settings.height), "N")
+      ("scale", "scaling of the frames to the window : none, integer or stretch", cxxopts::value<std::string>(settings.scale_mode), "MODE")
+      ("target-frame-time", "scale the frames down to render them in MS milliseconds, 0 for a fixed size", cxxopts::value<float>(settings.target_frame_time), "MS")
       ("fov", "sets the field of view angle ", cxxopts::value<unsigned int>(settings.fov))
+      ("threads", "number of rendering threads", cxxopts::value<unsigned int>(settings.thread_count), "N")
+      ("packet", "traverse the rays of adjacent columns by packets", cxxopts::value<bool>(settings.packet_traversal))
+      ("scanline", "draw floors and ceilings row by row", cxxopts::value<bool>(settings.scanline_floors))
+      ("floor-subdivision", "perspective correction of floors every N pixels, 0 for exact", cxxopts::value<unsigned int>(settings.floor_subdivision), "N")
+      ("fixed-kernels", "step texture coordinates in fixed point when drawing walls and subdivided floors", cxxopts::value<bool>(settings.fixed_kernels))
 			("i, input", "path to the map to open", cxxopts::value<std::string>(), "FILE")
+			("record", "record the camera path to FILE, for reblochon-bench", cxxopts::value<std::string>(settings.record_path), "FILE")
+			("trace", "on exit, write the timeline of the last frames to FILE, as Chrome trace events", cxxopts::value<std::string>(settings.trace_path), "FILE")
 			("help", "Print help")
 		;
 
@@ -126,6 +164,29 @@ parse(int argc, char* argv[], Settings& settings) {
 		std::cerr << "field of view angle should be in the ]0, 180[ range" << std::endl;
 		exit(EXIT_FAILURE);	
 	}
+
+	if ((settings.width == 0) or (settings.height == 0)) {
+		std::cerr << "frame size should be at least 1x1" << std::endl;
+		exit(EXIT_FAILURE);	
+	}
+
+	if ((settings.scale_mode != "none") and (settings.scale_mode != "integer") and (settings.scale_mode != "stretch")) {
+		std::cerr << "scale mode should be none, integer or stretch" << std::endl;
+		exit(EXIT_FAILURE);	
+	}
+
+	if (settings.target_frame_time < 0) {
+		std::cerr << "target frame time should be positive" << std::endl;
+		exit(EXIT_FAILURE);	
+	}
+
+	if (settings.thread_count == 0) {
+		std::cerr << "number of rendering threads should be at least 1" << std::endl;
+		exit(EXIT_FAILURE);	
+	}
+
+	if (settings.fixed_kernels and (not settings.scanline_floors) and (settings.floor_subdivision <= 1))
+		std::cerr << "warning: fixed point kernels only apply to walls unless floors are subdivided, see --floor-subdivision" << std::endl;
 }
 
 
@@ -168,16 +229,26 @@ main(int argc, char* argv[]) {
 		return EXIT_FAILURE;
 	}
 
-	Renderer view_renderer(SCREEN_WIDTH, SCREEN_HEIGHT,
+	Renderer view_renderer(settings.width, settings.height,
 	                       texture_atlas,
-	                       Renderer::focal_length_from_angle((M_PI / 180.f) * settings.fov));
+	                       Renderer::focal_length_from_angle((M_PI / 180.f) * settings.fov),
+	                       settings.thread_count);
+	view_renderer.packet_traversal() = settings.packet_traversal;
+	if (settings.scanline_floors)
+		view_renderer.floor_mode() = Renderer::SCANLINE_FLOOR_MODE;
+	view_renderer.floor_subdivision() = settings.floor_subdivision;
+	if (settings.fixed_kernels)
+		view_renderer.kernel_mode() = Renderer::FIXED_KERNEL_MODE;
 
 	// Create a window
 	Uint32 window_flags = 0;
 	if (settings.fullscreen)
 		window_flags |= SDL_WINDOW_FULLSCREEN_DESKTOP;
 
-	SDL_Window* window = SDL_CreateWindow("reblochon-3d editor", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, SCREEN_WIDTH, SCREEN_HEIGHT, window_flags);
+	SDL_Window* window = SDL_CreateWindow("reblochon-3d editor", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+	                                      std::max(settings.width, SCREEN_WIDTH),
+	                                      std::max(settings.height, SCREEN_HEIGHT),
+	                                      window_flags);
 	if (!window) {
 		SDL_LogError(SDL_LOG_CATEGORY_VIDEO, "Could not create window: %s\n", SDL_GetError());
 		SDL_FreeSurface(texture_atlas);
@@ -198,79 +269,160 @@ main(int argc, char* argv[]) {
 	// Create an indexed color framebuffer	
 	SDL_Surface* indexed_color_framebuffer =
 		SDL_CreateRGBSurface(0,
-		                     SCREEN_WIDTH, SCREEN_HEIGHT, 8,
+		                     settings.width, settings.height, 8,
 		                     0x00000000,
 		                     0x00000000,
 		                     0x00000000,
 		                     0x00000000);
 	SDL_SetSurfacePalette(indexed_color_framebuffer, texture_atlas->format->palette);
 
-	SDL_Rect dst_rect;
-	dst_rect.x = std::max(0, (framebuffer->w - indexed_color_framebuffer->w) / 2);
-	dst_rect.y = std::max(0, (framebuffer->h - indexed_color_framebuffer->h) / 2);
-	dst_rect.w = indexed_color_framebuffer->w;
-	dst_rect.h = indexed_color_framebuffer->h;
+	// Size of the frames, adapted to their rendering time
+	ResolutionController resolution_controller(settings.width, settings.height, 1e-3 * settings.target_frame_time);
+	double render_time = 0;
+
+	// Profiling of each frame, only while the HUD shows it or a trace is
+	// recorded, as timing the stages has a cost
+	Profiler profiler;
+	bool tracing = !settings.trace_path.empty();
+
+	Tracer tracer(settings.thread_count, tracing ? 1 << 16 : 0);
+	if (tracing)
+		profiler.tracer() = &tracer;
+
+	// Copies the indexed color framebuffer to the window, on the rendering threads
+	Presenter presenter(texture_atlas->format->palette, &view_renderer.thread_pool());
+	if (settings.scale_mode == "integer")
+		presenter.scale_mode() = Presenter::INTEGER_SCALE_MODE;
+	else if (settings.scale_mode == "stretch")
+		presenter.scale_mode() = Presenter::STRETCH_SCALE_MODE;
+
+	Hud hud(texture_atlas->format->palette);
+	bool hud_visible = false;
 
 	// Event processing & display loop
+	CameraPath camera_path;
 	bool quit = false; 
 	while(!quit) {
+		Profiler* frame_profiler = (hud_visible or tracing) ? &profiler : 0;
+		view_renderer.profiler() = frame_profiler;
+
+		Tracer::Scope frame_trace_scope(profiler.tracer(), 0, "frame");
+
 		// Even read & process
-		SDL_Event event;
-		while (SDL_PollEvent(&event)) {
-			switch(event.type) {
-				case SDL_QUIT:
-					quit = true;
-					break;
-
-				case SDL_KEYDOWN:
-					switch(event.key.keysym.sym) {
-						case SDLK_ESCAPE:
-							quit = true;
-							break;
-
-						case SDLK_UP:
-							state.move_forward();
-							break;
-
-						case SDLK_DOWN:
-							state.move_backward();
-							break;
-
-						case SDLK_LEFT:
-							state.rotate_left();
-							break;
-
-						case SDLK_RIGHT:
-							state.rotate_right();
-							break;
-
-						case SDLK_SPACE:
-							state.move_up();
-							break;
-
-						case SDLK_LSHIFT:
-							state.move_down();
-							break;
-
-						default:
-							break;
-					}
-					break;
-
-				default:
-					break;
+		{
+			Profiler::ScopedTimer timer(frame_profiler, Profiler::EVENT_STAGE);
+			SDL_Event event;
+			while (SDL_PollEvent(&event)) {
+				switch(event.type) {
+					case SDL_QUIT:
+						quit = true;
+						break;
+
+					case SDL_KEYDOWN:
+						switch(event.key.keysym.sym) {
+							case SDLK_ESCAPE:
+								quit = true;
+								break;
+
+							case SDLK_UP:
+								state.move_forward();
+								break;
+
+							case SDLK_DOWN:
+								state.move_backward();
+								break;
+
+							case SDLK_LEFT:
+								state.rotate_left();
+								break;
+
+							case SDLK_RIGHT:
+								state.rotate_right();
+								break;
+
+							case SDLK_SPACE:
+								state.move_up();
+								break;
+
+							case SDLK_LSHIFT:
+								state.move_down();
+								break;
+
+							case SDLK_h:
+								hud_visible = !hud_visible;
+								break;
+
+							default:
+								break;
+						}
+						break;
+
+					default:
+						break;
+				}
 			}
 		}
 
+		// Record the camera pose when it changes
+		if (!settings.record_path.empty()) {
+			const std::vector<CameraPath::Pose>& pose_list = camera_path.pose_list();
+			if (pose_list.empty() or (pose_list.back().pos() != state.pos()) or (pose_list.back().angle() != state.angle()))
+				camera_path.pose_list().push_back(CameraPath::Pose(state.pos(), state.angle()));
+		}
+
 		// Update the display
-		view_renderer.render(indexed_color_framebuffer, map, state.angle(), state.pos());
-		SDL_BlitSurface(indexed_color_framebuffer, NULL, framebuffer, &dst_rect);
-		SDL_UpdateWindowSurface(window);
+		{
+			Tracer::Scope trace_scope(profiler.tracer(), 0, "render");
+			Profiler::Stopwatch stopwatch;
+			view_renderer.render(indexed_color_framebuffer, map, state.angle(), state.pos());
+			render_time = stopwatch.lap();
+		}
+
+		if (hud_visible)
+			hud.draw(indexed_color_framebuffer, profiler);
+
+		{
+			Profiler::ScopedTimer timer(frame_profiler, Profiler::BLIT_STAGE);
+			presenter.present(indexed_color_framebuffer, framebuffer);
+		}
+
+		{
+			Profiler::ScopedTimer timer(frame_profiler, Profiler::UPDATE_STAGE);
+			SDL_UpdateWindowSurface(window);
+		}
+
+		// Change the size of the next frames if they are too slow or too fast
+		if ((settings.target_frame_time > 0) and resolution_controller.update(render_time)) {
+			view_renderer.resize(resolution_controller.width(), resolution_controller.height());
+
+			SDL_FreeSurface(indexed_color_framebuffer);
+			indexed_color_framebuffer =
+				SDL_CreateRGBSurface(0,
+				                     view_renderer.width(), view_renderer.height(), 8,
+				                     0x00000000,
+				                     0x00000000,
+				                     0x00000000,
+				                     0x00000000);
+			SDL_SetSurfacePalette(indexed_color_framebuffer, texture_atlas->format->palette);
+		}
+
+		if (frame_profiler)
+			profiler.end_frame();
 
 		// Sleep for a while
 		SDL_Delay(20);
 	}
 
+	// Save the recorded camera path
+	if (!settings.record_path.empty())
+		if (!camera_path.save(settings.record_path.c_str()))
+			SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Could not save camera path '%s': %s\n", settings.record_path.c_str(), SDL_GetError());
+
+	// Save the timeline of the last frames
+	if (!settings.trace_path.empty())
+		if (!tracer.save(settings.trace_path.c_str()))
+			SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Could not save trace '%s': %s\n", settings.trace_path.c_str(), SDL_GetError());
+
 	// Free ressources
 	SDL_FreeSurface(indexed_color_framebuffer);
 	SDL_FreeSurface(texture_atlas);
@@ -1,134 +1,449 @@
 #include "SDL.h"
 #include "Map.h"
+#include "MappedFile.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 using namespace reb;
 
 
 
-Map::Cell::Cell() :
-	m_height(0),
-	m_wall_texture_id(0),
-	m_floor_texture_id(0) { }
+// --- Map file loading -------------------------------------------------------
 
+namespace {
+	const char* file_signature = "reblochon3d-map";
+	const std::size_t file_signature_len = 15;
+	const std::size_t file_header_size = file_signature_len + 4;
 
+	// Little endian reads from unaligned bytes, a single load on x86
+	inline std::uint16_t
+	read_le16(const std::uint8_t* src) {
+		return std::uint16_t(src[0] | (src[1] << 8));
+	}
 
-Map::Map() :
-	m_cell_array(1, 1) { }
+	inline std::uint32_t
+	read_le32(const std::uint8_t* src) {
+		return std::uint32_t(src[0]) | (std::uint32_t(src[1]) << 8) | (std::uint32_t(src[2]) << 16) | (std::uint32_t(src[3]) << 24);
+	}
 
+	// A cell of version 1 : the height as LE32, the wall and floor texture ids.
+	// Returns false if the height does not fit in a cell.
+	inline bool
+	decode_cell(const std::uint8_t* src, Map::Cell& cell) {
+		std::uint32_t height = read_le32(src);
+		cell.height() = std::uint16_t(height);
+		cell.wall_texture_id() = src[4];
+		cell.floor_texture_id() = src[5];
+		return height <= 0xffff;
+	}
 
 
-Map::Map(int w, int h)
-	: m_spawn_point(0, 0), 
-    m_cell_array(w, h) { }
 
+	bool
+	load_version_1(const std::uint8_t* data, std::size_t size, Map& map) {
+		const char* spawn_tag = "spawn";
+		const char* map_tag = "_map_";
+		const std::size_t tag_len = 5;
+		const std::size_t cell_size = 6;
 
+		// While there are tags
+		bool map_tag_found = false;
+		bool spawn_tag_found = false;
+		Eigen::Vector2f spawn_point(0, 0);
 
-bool
-Map::load(const char* path, Map& map) {
-	const char* spawn_tag = "spawn";
-	const char* map_tag = "_map_";
-	const int tag_len = 5;
+		std::size_t offset = file_header_size;
+		while(size - offset >= tag_len) {
+			const std::uint8_t* tag = data + offset;
+			offset += tag_len;
 
-	std::uint32_t file_version_number = 1;
-	const char* file_signature = "reblochon3d-map";
-	const int file_signature_len = 15;
+			// Found a map tag
+			if ((memcmp(tag, map_tag, tag_len) == 0) and !map_tag_found) {
+				map_tag_found = true;
 
-	// Open input file
-	SDL_RWops* file = SDL_RWFromFile(path, "rb");
-	if (file == NULL)
-		return false;
+				// Read the size of the map
+				if (size - offset < 4) {
+					SDL_SetError("truncated map size");
+					return false;
+				}
+
+				int map_w = read_le16(data + offset);
+				int map_h = read_le16(data + offset + 2);
+				offset += 4;
+
+				if ((map_w == 0) or (map_h == 0)) {
+					SDL_SetError("empty map");
+					return false;
+				}
+
+				std::size_t cell_data_size = cell_size * map_w * map_h;
+				if (size - offset < cell_data_size) {
+					SDL_SetError("truncated map cells");
+					return false;
+				}
+				map = Map(map_w, map_h);
+
+				// Read the cells, stored i-major, chunk by chunk. A chunk is read
+				// through a few sequential streams, one per column.
+				const std::uint8_t* cell_data = data + offset;
+				Map::cell_array_type& cell_array = map.cell_array();
+				const int chunk_size = Map::cell_array_type::chunk_size;
+
+				auto column_data = [&](int i, int j) {
+					return cell_data + cell_size * (std::size_t(i) * map_h + j);
+				};
+
+				// Find the uniform chunks first, so that the dense ones are
+				// allocated at once. Scanning a dense chunk stops at its first
+				// differing cell, and a uniform chunk is not scanned again.
+				std::vector<bool> uniform_chunk_list;
+				std::size_t dense_chunk_count = 0;
+				for(std::size_t chunk_j = 0; chunk_j < cell_array.chunk_h(); ++chunk_j) {
+					for(std::size_t chunk_i = 0; chunk_i < cell_array.chunk_w(); ++chunk_i) {
+						int i_start = chunk_i * chunk_size;
+						int j_start = chunk_j * chunk_size;
+						int i_end = std::min(i_start + chunk_size, map_w);
+						int j_end = std::min(j_start + chunk_size, map_h);
 
-	// Read and check the signature
-	{
-		char signature[file_signature_len];
-		memset(signature, 0, file_signature_len);
-		if (SDL_RWread(file, signature, file_signature_len, 1) == 0)
+						const std::uint8_t* first = column_data(i_start, j_start);
+						bool uniform = true;
+						for(int i = i_start; (i < i_end) and uniform; ++i) {
+							const std::uint8_t* src = column_data(i, j_start);
+							for(int j = j_start; (j < j_end) and uniform; ++j, src += cell_size)
+								uniform = memcmp(src, first, cell_size) == 0;
+						}
+
+						uniform_chunk_list.push_back(uniform);
+						dense_chunk_count += !uniform;
+					}
+				}
+				cell_array.reserve_chunks(dense_chunk_count, uniform_chunk_list.size() - dense_chunk_count);
+
+				Map::Cell chunk_cell_list[Map::cell_array_type::chunk_value_count];
+				bool valid_heights = true;
+
+				for(std::size_t chunk_j = 0, k = 0; chunk_j < cell_array.chunk_h(); ++chunk_j) {
+					for(std::size_t chunk_i = 0; chunk_i < cell_array.chunk_w(); ++chunk_i, ++k) {
+						int i_start = chunk_i * chunk_size;
+						int j_start = chunk_j * chunk_size;
+						int i_end = std::min(i_start + chunk_size, map_w);
+						int j_end = std::min(j_start + chunk_size, map_h);
+
+						if (uniform_chunk_list[k]) {
+							Map::Cell cell;
+							valid_heights &= decode_cell(column_data(i_start, j_start), cell);
+							cell_array.fill_chunk(chunk_i, chunk_j, cell);
+						}
+						else {
+							for(int i = i_start; i < i_end; ++i) {
+								const std::uint8_t* src = column_data(i, j_start);
+								Map::Cell* dst = chunk_cell_list + (i - i_start);
+								for(int j = j_start; j < j_end; ++j, src += cell_size, dst += chunk_size)
+									valid_heights &= decode_cell(src, *dst);
+							}
+
+							cell_array.assign_chunk(chunk_i, chunk_j, chunk_cell_list);
+						}
+
+						if (!valid_heights) {
+							SDL_SetError("cell height out of range");
+							return false;
+						}
+					}
+				}
+
+				offset += cell_data_size;
+			}
+			// Found a spawn tag
+			else if ((memcmp(tag, spawn_tag, tag_len) == 0) and !spawn_tag_found) {
+				spawn_tag_found = true;
+
+				if (size - offset < 8) {
+					SDL_SetError("truncated spawn point");
+					return false;
+				}
+
+				std::int32_t x = static_cast<std::int32_t>(read_le32(data + offset));
+				std::int32_t y = static_cast<std::int32_t>(read_le32(data + offset + 4));
+				spawn_point = Eigen::Vector2f(x / 256.f, y / 256.f);
+				offset += 8;
+			}
+			// Unknown tag
+			else {
+				SDL_SetError("unsupported tag");
+				return false;
+			}
+		}
+
+		// Check that we found all the required tags
+		if (!map_tag_found) {
+			SDL_SetError("no map defined");
 			return false;
+		}
 
-		if (strncmp(signature, file_signature, file_signature_len) != 0) {
-			SDL_SetError("wrong file format signature");
+		if (!spawn_tag_found) {
+			SDL_SetError("no spawn point defined");
 			return false;
 		}
+
+		// Setup the spawn point
+		map.spawn_point() = spawn_point;
+
+		// Job done
+		return true;
 	}
 
-	// Read and check the version number
-	{
-		std::uint32_t version_number = SDL_ReadLE32(file);
-		if (version_number != file_version_number) {
-			SDL_SetError("unsupported file format version");
-			return false;	
+
+
+	bool
+	load_version_2(const std::uint8_t* data, std::size_t size, Map& map) {
+		typedef Map::cell_array_type cell_array_type;
+		const std::size_t header_size = 40;
+		const std::size_t chunk_entry_size = 8;
+		const std::size_t cell_size = 4;
+		const std::size_t chunk_data_size = cell_size * cell_array_type::chunk_value_count;
+
+		// Cells are copied as they are stored, in the layout of the cell array
+		static_assert(sizeof(Map::Cell) == cell_size, "cells should be packed in 4 bytes");
+		static_assert(std::is_same<cell_array_type::layout_type, MortonLayout>::value, "chunks should be in Morton order");
+
+		if (size < header_size) {
+			SDL_SetError("truncated header");
+			return false;
 		}
-	}
 
-	// While there are tags
-	bool map_tag_found = false;
-	bool spawn_tag_found = false;
-	Eigen::Vector2f spawn_point(0, 0);
-
-	while(true) {
-		// Read the tag
-		char tag[tag_len];
-		memset(tag, 0, tag_len);
-		if (SDL_RWread(file, tag, tag_len, 1) == 0)
-			break;
-
-		// Found a map tag
-		if ((strncmp(tag, map_tag, tag_len) == 0) and !map_tag_found) {
-			map_tag_found = true;
-
-			// Read the size of the map
-			std::uint16_t map_w = SDL_ReadLE16(file);	
-			std::uint16_t map_h = SDL_ReadLE16(file);	
-			map = Map(map_w, map_h);
-
-			// Read the cells data
-			for(std::uint16_t i = 0; i < map_w; ++i) {
-				for(std::uint16_t j = 0; j < map_h; ++j) {
-					// Read cell data
-					std::uint32_t height = SDL_ReadLE32(file);
-					std::uint8_t wall_texture_id = SDL_ReadU8(file);
-					std::uint8_t floor_texture_id = SDL_ReadU8(file);
-
-					// Write cell data
-					Map::Cell& cell = map.cell_array()(i, j);
-					cell.height() = height;
-					cell.wall_texture_id() = wall_texture_id;
-					cell.floor_texture_id() = floor_texture_id;
-				}
+		// Read the header
+		std::uint32_t map_w = read_le32(data + 20);
+		std::uint32_t map_h = read_le32(data + 24);
+		std::int32_t spawn_x = static_cast<std::int32_t>(read_le32(data + 28));
+		std::int32_t spawn_y = static_cast<std::int32_t>(read_le32(data + 32));
+		std::uint32_t chunk_data_offset = read_le32(data + 36);
+
+		if ((map_w == 0) or (map_h == 0)) {
+			SDL_SetError("empty map");
+			return false;
+		}
+
+		if ((map_w > INT_MAX) or (map_h > INT_MAX)) {
+			SDL_SetError("map too large");
+			return false;
+		}
+
+		// Read the chunk directory, counting the dense chunks
+		std::size_t chunk_w = (std::size_t(map_w) + cell_array_type::chunk_size - 1) >> cell_array_type::chunk_shift;
+		std::size_t chunk_h = (std::size_t(map_h) + cell_array_type::chunk_size - 1) >> cell_array_type::chunk_shift;
+		std::size_t chunk_count = chunk_w * chunk_h;
+		if (chunk_count > (size - header_size) / chunk_entry_size) {
+			SDL_SetError("truncated chunk directory");
+			return false;
+		}
+
+		const std::uint8_t* chunk_entry_list = data + header_size;
+		std::size_t dense_chunk_count = 0;
+		for(std::size_t k = 0; k < chunk_count; ++k) {
+			std::uint32_t chunk_kind = read_le32(chunk_entry_list + k * chunk_entry_size);
+			if (chunk_kind > 1) {
+				SDL_SetError("invalid chunk kind");
+				return false;
 			}
+			dense_chunk_count += chunk_kind;
 		}
-		// Found a spawn tag
-		else if ((strncmp(tag, spawn_tag, tag_len) == 0) and !spawn_tag_found) {
-			spawn_tag_found = true;
-			std::int32_t x = static_cast<std::int32_t>(SDL_ReadLE32(file));
-			std::int32_t y = static_cast<std::int32_t>(SDL_ReadLE32(file));
-			spawn_point = Eigen::Vector2f(x / 256.f, y / 256.f);
+
+		if ((chunk_data_offset < header_size + chunk_count * chunk_entry_size) or (chunk_data_offset % 64 != 0) or (chunk_data_offset > size)) {
+			SDL_SetError("invalid chunks offset");
+			return false;
 		}
-		// Unknown tag
-		else {
-			SDL_SetError("unsupported tag");			
+
+		if (dense_chunk_count > (size - chunk_data_offset) / chunk_data_size) {
+			SDL_SetError("truncated map cells");
 			return false;
 		}
+
+		map = Map(map_w, map_h);
+		map.spawn_point() = Eigen::Vector2f(spawn_x / 256.f, spawn_y / 256.f);
+
+		// Copy the chunks, a dense chunk at once
+		cell_array_type& cell_array = map.cell_array();
+		cell_array.reserve_chunks(dense_chunk_count, chunk_count - dense_chunk_count);
+
+		const std::uint8_t* chunk_entry = chunk_entry_list;
+		const std::uint8_t* chunk_data = data + chunk_data_offset;
+		for(std::size_t chunk_j = 0; chunk_j < chunk_h; ++chunk_j) {
+			for(std::size_t chunk_i = 0; chunk_i < chunk_w; ++chunk_i, chunk_entry += chunk_entry_size) {
+				if (read_le32(chunk_entry) == 0) {
+					Map::Cell cell;
+					memcpy(&cell, chunk_entry + 4, cell_size);
+					cell.height() = SDL_SwapLE16(cell.height());
+					cell_array.fill_chunk(chunk_i, chunk_j, cell);
+				}
+				else {
+					Map::Cell* cell_list = cell_array.dense_chunk_data(chunk_i, chunk_j);
+					memcpy(cell_list, chunk_data, chunk_data_size);
+					for(std::size_t k = 0; k < cell_array_type::chunk_value_count; ++k)
+						cell_list[k].height() = SDL_SwapLE16(cell_list[k].height());
+					chunk_data += chunk_data_size;
+				}
+			}
+		}
+
+		// Job done
+		return true;
 	}
+} // namespace
 
-	// Check that we found all the required tags
-	if (!map_tag_found) {
-		SDL_SetError("no map defined");
-		return false;
+
+
+// --- Max height pyramid -----------------------------------------------------
+
+namespace {
+	// Each value of dst is the max of height() over a block of 2x2 values of
+	// src, chunk by chunk. A chunk covering uniform source chunks of the same
+	// value is uniform as well, thus empty areas are downsampled for free.
+	template <class A, class F>
+	void
+	downsample_max_height(const A& src, F height, Map::height_array_type& dst) {
+		typedef Map::height_array_type level_type;
+		const int chunk_size = level_type::chunk_size;
+
+		int src_w = src.w();
+		int src_h = src.h();
+		std::uint16_t chunk_height_list[level_type::chunk_value_count];
+
+		// Whether the chunk only covers uniform source chunks of a same height
+		auto covers_uniform_chunks = [&](std::size_t chunk_i, std::size_t chunk_j, std::uint16_t& uniform_height) {
+			std::size_t src_chunk_i_end = std::min(2 * chunk_i + 2, src.chunk_w());
+			std::size_t src_chunk_j_end = std::min(2 * chunk_j + 2, src.chunk_h());
+
+			bool uniform = true;
+			uniform_height = height(src(2 * chunk_i * chunk_size, 2 * chunk_j * chunk_size));
+			for(std::size_t src_chunk_j = 2 * chunk_j; (src_chunk_j < src_chunk_j_end) and uniform; ++src_chunk_j)
+				for(std::size_t src_chunk_i = 2 * chunk_i; (src_chunk_i < src_chunk_i_end) and uniform; ++src_chunk_i)
+					uniform = src.is_uniform_chunk(src_chunk_i, src_chunk_j) and (height(src(src_chunk_i * chunk_size, src_chunk_j * chunk_size)) == uniform_height);
+
+			return uniform;
+		};
+
+		// Allocate the chunks which may be dense at once, from the directory of
+		// the source
+		std::uint16_t uniform_height;
+		std::size_t dense_chunk_count = 0;
+		for(std::size_t chunk_j = 0; chunk_j < dst.chunk_h(); ++chunk_j)
+			for(std::size_t chunk_i = 0; chunk_i < dst.chunk_w(); ++chunk_i)
+				dense_chunk_count += !covers_uniform_chunks(chunk_i, chunk_j, uniform_height);
+		dst.reserve_chunks(dense_chunk_count, dst.chunk_w() * dst.chunk_h());
+
+		for(std::size_t chunk_j = 0; chunk_j < dst.chunk_h(); ++chunk_j) {
+			for(std::size_t chunk_i = 0; chunk_i < dst.chunk_w(); ++chunk_i) {
+				if (covers_uniform_chunks(chunk_i, chunk_j, uniform_height)) {
+					dst.fill_chunk(chunk_i, chunk_j, uniform_height);
+					continue;
+				}
+
+				// Max over the 2x2 blocks within the source
+				int i_start = chunk_i * chunk_size;
+				int j_start = chunk_j * chunk_size;
+				int i_end = std::min(i_start + chunk_size, int(dst.w()));
+				int j_end = std::min(j_start + chunk_size, int(dst.h()));
+
+				for(int j = j_start; j < j_end; ++j) {
+					for(int i = i_start; i < i_end; ++i) {
+						std::uint16_t max_height = 0;
+						for(int dj = 2 * j; dj < std::min(2 * j + 2, src_h); ++dj)
+							for(int di = 2 * i; di < std::min(2 * i + 2, src_w); ++di)
+								max_height = std::max(max_height, height(src(di, dj)));
+						chunk_height_list[(j - j_start) * chunk_size + (i - i_start)] = max_height;
+					}
+				}
+
+				dst.assign_chunk(chunk_i, chunk_j, chunk_height_list);
+			}
+		}
 	}
+} // namespace
 
-	if (!spawn_tag_found) {
-		SDL_SetError("no spawn point defined");
-		return false;
+
+
+// --- Map --------------------------------------------------------------------
+
+
+
+Map::Cell::Cell() :
+	m_height(0),
+	m_wall_texture_id(0),
+	m_floor_texture_id(0) { }
+
+
+
+Map::Map() :
+	m_cell_array(1, 1) { }
+
+
+
+Map::Map(int w, int h)
+	: m_spawn_point(0, 0), 
+    m_cell_array(w, h) { }
+
+
+
+void
+Map::build_max_height_pyramid() {
+	m_max_height_pyramid.clear();
+
+	// Halve the resolution until a single block covers the whole map
+	int w = m_cell_array.w();
+	int h = m_cell_array.h();
+	while((w > 1) or (h > 1)) {
+		height_array_type level((w + 1) / 2, (h + 1) / 2);
+
+		if (m_max_height_pyramid.empty())
+			downsample_max_height(m_cell_array, [](const Cell& cell) { return cell.height(); }, level);
+		else
+			downsample_max_height(m_max_height_pyramid.back(), [](std::uint16_t height) { return height; }, level);
+
+		m_max_height_pyramid.push_back(std::move(level));
+		w = (w + 1) / 2;
+		h = (h + 1) / 2;
 	}
+}
+
+
+
+bool
+Map::load(const char* path, Map& map) {
+	MappedFile file;
+	if (!file.open(path))
+		return false;
 
-	// Setup the spawn point
-	map.spawn_point() = spawn_point;
+	// Check the signature
+	if ((file.size() < file_header_size) or (memcmp(file.data(), file_signature, file_signature_len) != 0)) {
+		SDL_SetError("wrong file format signature");
+		return false;
+	}
 
-	// Close input file
-	if (SDL_RWclose(file) != 0)
+	// Read the cells with the loader of the version, into a map of our own so
+	// that the caller's map is left untouched if the file is rejected
+	Map loaded_map;
+	std::uint32_t version_number = read_le32(file.data() + file_signature_len);
+	if (version_number == 1) {
+		if (!load_version_1(file.data(), file.size(), loaded_map))
+			return false;
+	}
+	else if (version_number == 2) {
+		if (!load_version_2(file.data(), file.size(), loaded_map))
+			return false;
+	}
+	else {
+		SDL_SetError("unsupported file format version");
 		return false;
+	}
+
+	// Setup the acceleration structures
+	loaded_map.build_max_height_pyramid();
 
 	// Job done
+	map = std::move(loaded_map);
 	return true;
 }
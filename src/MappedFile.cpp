@@ -0,0 +1,73 @@
+#include <SDL.h>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "MappedFile.h"
+
+using namespace reb;
+
+
+
+MappedFile::MappedFile() :
+	m_data(0),
+	m_size(0) { }
+
+
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+
+
+bool
+MappedFile::open(const char* path) {
+	close();
+
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0) {
+		SDL_SetError("could not open '%s' for reading: %s", path, strerror(errno));
+		return false;
+	}
+
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) != 0) {
+		SDL_SetError("could not read '%s': %s", path, strerror(errno));
+		::close(fd);
+		return false;
+	}
+
+	// Nothing to map
+	if (file_stat.st_size == 0) {
+		::close(fd);
+		return true;
+	}
+
+	void* data = mmap(0, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (data == MAP_FAILED) {
+		SDL_SetError("could not map '%s': %s", path, strerror(errno));
+		return false;
+	}
+
+	// The file is read front to back, let the kernel read ahead
+	madvise(data, file_stat.st_size, MADV_SEQUENTIAL);
+
+	m_data = static_cast<const std::uint8_t*>(data);
+	m_size = file_stat.st_size;
+	return true;
+}
+
+
+
+void
+MappedFile::close() {
+	if (m_data)
+		munmap(const_cast<std::uint8_t*>(m_data), m_size);
+
+	m_data = 0;
+	m_size = 0;
+}
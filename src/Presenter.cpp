@@ -0,0 +1,250 @@
+#include "Presenter.h"
+#include <algorithm>
+#include <cstring>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+using namespace reb;
+
+
+
+Presenter::Presenter(const SDL_Palette* palette, ThreadPool* thread_pool) :
+	m_thread_pool(thread_pool),
+	m_color_count(0),
+	m_table_valid(false),
+	m_table_format(0),
+	m_scale_mode(NO_SCALE_MODE),
+	m_layout_key { 0, 0, 0, 0, 0, 0 },
+	m_layout_pixels(0),
+	m_dst_rect { 0, 0, 0, 0 } {
+	set_palette(palette);
+}
+
+
+
+void
+Presenter::set_palette(const SDL_Palette* palette) {
+	// Unused entries are black
+	for(int k = 0; k < 256; ++k)
+		m_color_list[k] = SDL_Color { 0, 0, 0, 0xff };
+
+	m_color_count = palette ? std::min(palette->ncolors, 256) : 0;
+	if (m_color_count > 0)
+		std::copy(palette->colors, palette->colors + m_color_count, m_color_list);
+
+	m_table_valid = false;
+}
+
+
+
+bool
+Presenter::present(SDL_Surface* src, SDL_Surface* dst) {
+	bool layout_changed = update_layout(src, dst);
+
+	// Anything else than 32 bits pixels goes through SDL
+	if (dst->format->BytesPerPixel != 4) {
+		SDL_Rect dst_rect = m_dst_rect;
+		if (layout_changed)
+			SDL_FillRect(dst, NULL, SDL_MapRGB(dst->format, 0, 0, 0));
+		if (m_scale_mode == NO_SCALE_MODE)
+			return SDL_BlitSurface(src, NULL, dst, &dst_rect) == 0;
+		return SDL_BlitScaled(src, NULL, dst, &dst_rect) == 0;
+	}
+
+	if ((!m_table_valid) or (m_table_format != dst->format->format))
+		update_table(dst->format);
+
+	// Visible part of the destination rectangle
+	int i_start = std::max(0, (int)m_dst_rect.x), i_end = std::min(dst->w, m_dst_rect.x + m_dst_rect.w);
+	int j_start = std::max(0, (int)m_dst_rect.y), j_end = std::min(dst->h, m_dst_rect.y + m_dst_rect.h);
+
+	if (SDL_MUSTLOCK(dst))
+		if (SDL_LockSurface(dst) != 0)
+			return false;
+
+	// The window surface keeps its content, the borders are cleared once
+	if (layout_changed)
+		clear_borders(dst);
+
+	if ((i_start >= i_end) or (j_start >= j_end)) {
+		if (SDL_MUSTLOCK(dst))
+			SDL_UnlockSurface(dst);
+		return true;
+	}
+
+	// Each thread expands a contiguous band of rows
+	int thread_count = m_thread_pool ? m_thread_pool->size() : 1;
+	bool scaled = (m_dst_rect.w != src->w) or (m_dst_rect.h != src->h);
+	auto present_band = [&](int thread_index) {
+		int band_start = j_start + ((j_end - j_start) * thread_index) / thread_count;
+		int band_end   = j_start + ((j_end - j_start) * (thread_index + 1)) / thread_count;
+
+		std::uint32_t* scratch = m_scratch.data() + thread_index * (src->w + 8);
+
+		int prev_src_j = -1;
+		std::uint32_t* prev_dst_row = 0;
+		for(int j = band_start; j < band_end; ++j) {
+			int src_j = ((j - m_dst_rect.y) * src->h) / m_dst_rect.h;
+			const std::uint8_t* src_row = (const std::uint8_t*)src->pixels + src_j * src->pitch;
+			std::uint32_t* dst_row = (std::uint32_t*)((std::uint8_t*)dst->pixels + j * dst->pitch) + i_start;
+
+			if (src_j == prev_src_j)
+				std::memcpy(dst_row, prev_dst_row, (i_end - i_start) * sizeof(std::uint32_t));
+			else if (scaled)
+				expand_scaled_row(src_row, src->w,
+				                  m_x_list.data(), dst_row, i_end - i_start,
+				                  m_table, scratch);
+			else
+				expand_row(src_row + (i_start - m_dst_rect.x), dst_row, i_end - i_start, m_table);
+
+			prev_src_j = src_j;
+			prev_dst_row = dst_row;
+		}
+	};
+
+	if (m_thread_pool)
+		m_thread_pool->run(present_band);
+	else
+		present_band(0);
+
+	if (SDL_MUSTLOCK(dst))
+		SDL_UnlockSurface(dst);
+
+	// Job done
+	return true;
+}
+
+
+
+void
+Presenter::expand_row(const std::uint8_t* src,
+                      std::uint32_t* dst,
+                      int count,
+                      const std::uint32_t* table) {
+	int i = 0;
+
+#ifdef __AVX2__
+	for( ; i + 8 <= count; i += 8) {
+		__m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src + i)));
+		__m256i pixel = _mm256_i32gather_epi32((const int*)table, index, 4);
+		_mm256_storeu_si256((__m256i*)(dst + i), pixel);
+	}
+#endif
+
+	for( ; i < count; ++i)
+		dst[i] = table[src[i]];
+}
+
+
+
+void
+Presenter::expand_scaled_row(const std::uint8_t* src,
+                             int src_count,
+                             const int* x_list,
+                             std::uint32_t* dst,
+                             int count,
+                             const std::uint32_t* table,
+                             std::uint32_t* scratch) {
+	if (count <= 0)
+		return;
+
+	// Only expand the source pixels which are picked
+	int x_start = x_list[0], x_end = std::min(src_count, x_list[count - 1] + 1);
+	expand_row(src + x_start, scratch + x_start, x_end - x_start, table);
+
+	int i = 0;
+
+#ifdef __AVX2__
+	// When upscaling, 8 destination pixels come from 8 consecutive source
+	// pixels, picked with a permute rather than a gather
+	for( ; i + 8 <= count; i += 8) {
+		int base = x_list[i];
+		__m256i x = _mm256_loadu_si256((const __m256i*)(x_list + i));
+		__m256i pixel;
+		if (x_list[i + 7] - base < 8) {
+			__m256i window = _mm256_loadu_si256((const __m256i*)(scratch + base));
+			pixel = _mm256_permutevar8x32_epi32(window, _mm256_sub_epi32(x, _mm256_set1_epi32(base)));
+		}
+		else
+			pixel = _mm256_i32gather_epi32((const int*)scratch, x, 4);
+		_mm256_storeu_si256((__m256i*)(dst + i), pixel);
+	}
+#endif
+
+	for( ; i < count; ++i)
+		dst[i] = scratch[x_list[i]];
+}
+
+
+
+void
+Presenter::update_table(const SDL_PixelFormat* format) {
+	for(int k = 0; k < 256; ++k)
+		m_table[k] = SDL_MapRGB(format, m_color_list[k].r, m_color_list[k].g, m_color_list[k].b);
+
+	m_table_valid = true;
+	m_table_format = format->format;
+}
+
+
+
+bool
+Presenter::update_layout(const SDL_Surface* src, const SDL_Surface* dst) {
+	int key[6] = { src->w, src->h, dst->w, dst->h, dst->pitch, m_scale_mode };
+	if (std::equal(key, key + 6, m_layout_key) and (m_layout_pixels == dst->pixels))
+		return false;
+
+	std::copy(key, key + 6, m_layout_key);
+	m_layout_pixels = dst->pixels;
+
+	// Size of src on dst, shrinking to fit when an integer scale is too large
+	int w = src->w, h = src->h;
+	int integer_scale = std::min(dst->w / src->w, dst->h / src->h);
+	if ((m_scale_mode == INTEGER_SCALE_MODE) and (integer_scale >= 1)) {
+		w = integer_scale * src->w;
+		h = integer_scale * src->h;
+	}
+	else if (m_scale_mode != NO_SCALE_MODE) {
+		if (dst->w * src->h < dst->h * src->w) {
+			w = dst->w;
+			h = std::max(1, (dst->w * src->h) / src->w);
+		}
+		else {
+			w = std::max(1, (dst->h * src->w) / src->h);
+			h = dst->h;
+		}
+	}
+
+	m_dst_rect.x = (dst->w - w) / 2;
+	m_dst_rect.y = (dst->h - h) / 2;
+	m_dst_rect.w = w;
+	m_dst_rect.h = h;
+
+	// Source column of each visible destination column
+	int i_start = std::max(0, (int)m_dst_rect.x), i_end = std::min(dst->w, m_dst_rect.x + m_dst_rect.w);
+	m_x_list.resize(std::max(0, i_end - i_start));
+	for(int i = i_start; i < i_end; ++i)
+		m_x_list[i - i_start] = ((i - m_dst_rect.x) * src->w) / m_dst_rect.w;
+
+	int thread_count = m_thread_pool ? m_thread_pool->size() : 1;
+	m_scratch.assign(thread_count * (src->w + 8), 0);
+
+	return true;
+}
+
+
+
+void
+Presenter::clear_borders(SDL_Surface* dst) {
+	std::uint32_t black = SDL_MapRGB(dst->format, 0, 0, 0);
+	for(int j = 0; j < dst->h; ++j) {
+		std::uint32_t* dst_row = (std::uint32_t*)((std::uint8_t*)dst->pixels + j * dst->pitch);
+		if ((j < m_dst_rect.y) or (j >= m_dst_rect.y + m_dst_rect.h))
+			std::fill(dst_row, dst_row + dst->w, black);
+		else {
+			std::fill(dst_row, dst_row + std::min(dst->w, std::max(0, (int)m_dst_rect.x)), black);
+			std::fill(dst_row + std::max(0, std::min(dst->w, m_dst_rect.x + m_dst_rect.w)), dst_row + dst->w, black);
+		}
+	}
+}
@@ -0,0 +1,120 @@
+#include "Profiler.h"
+#include <algorithm>
+
+using namespace reb;
+
+
+
+// --- Profiler::Stopwatch -----------------------------------------------------
+
+double
+Profiler::Stopwatch::overhead() {
+	static const double lap_overhead = [] {
+		const int lap_count = 1024;
+
+		Stopwatch stopwatch;
+		double total = 0;
+		for(int k = 0; k < lap_count; ++k)
+			total += stopwatch.lap();
+
+		return total / lap_count;
+	}();
+
+	return lap_overhead;
+}
+
+
+
+// --- Profiler ---------------------------------------------------------------
+
+Profiler::Profiler() :
+	m_tracer(0),
+	m_frame_index(0),
+	m_completed_frame_count(0) {
+	std::fill(&m_time_list[0][0], &m_time_list[0][0] + frame_count * STAGE_COUNT, 0.);
+	std::fill(&m_count_list[0][0], &m_count_list[0][0] + frame_count * COUNTER_COUNT, 0);
+}
+
+
+
+void
+Profiler::end_frame() {
+	m_completed_frame_count = std::min(m_completed_frame_count + 1, (int)frame_count);
+	m_frame_index = (m_frame_index + 1) % frame_count;
+
+	// Clear the oldest frame, to be filled
+	std::fill(m_time_list[m_frame_index], m_time_list[m_frame_index] + STAGE_COUNT, 0.);
+	std::fill(m_count_list[m_frame_index], m_count_list[m_frame_index] + COUNTER_COUNT, 0);
+}
+
+
+
+double
+Profiler::average(Stage stage) const {
+	if (m_completed_frame_count == 0)
+		return 0;
+
+	double sum = 0;
+	for(int k = 1; k <= m_completed_frame_count; ++k)
+		sum += m_time_list[(m_frame_index + frame_count - k) % frame_count][stage];
+
+	return sum / m_completed_frame_count;
+}
+
+
+
+double
+Profiler::average(Counter counter) const {
+	if (m_completed_frame_count == 0)
+		return 0;
+
+	double sum = 0;
+	for(int k = 1; k <= m_completed_frame_count; ++k)
+		sum += m_count_list[(m_frame_index + frame_count - k) % frame_count][counter];
+
+	return sum / m_completed_frame_count;
+}
+
+
+
+const char*
+Profiler::name(Stage stage) {
+	switch(stage) {
+		case EVENT_STAGE:
+			return "events";
+		case CLEAR_STAGE:
+			return "clear";
+		case TRAVERSAL_STAGE:
+			return "traversal";
+		case COVERAGE_STAGE:
+			return "coverage";
+		case DRAW_STAGE:
+			return "draw";
+		case TRANSPOSE_STAGE:
+			return "transpose";
+		case SPAN_STAGE:
+			return "spans";
+		case BLIT_STAGE:
+			return "blit";
+		case UPDATE_STAGE:
+			return "update";
+		default:
+			return "";
+	}
+}
+
+
+
+const char*
+Profiler::name(Counter counter) {
+	switch(counter) {
+		case CELL_COUNTER:
+			return "cells";
+		case FRAGMENT_COUNTER:
+			return "fragments";
+		case PIXEL_COUNTER:
+			return "pixels";
+		default:
+			return "";
+	}
+}
@@ -1,4 +1,7 @@
 #include "RayTraversal.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
 
 using namespace reb;
 
@@ -6,7 +9,15 @@ using namespace reb;
 
 RayTraversal::RayTraversal(const Grid2d& grid,
 		                       const Eigen::Vector2f& origin,
-		                       const Eigen::Vector2f& direction) {
+		                       const Eigen::Vector2f& direction) :
+	RayTraversal(grid, origin, direction, direction.cwiseInverse()) { }
+
+
+
+RayTraversal::RayTraversal(const Grid2d& grid,
+		                       const Eigen::Vector2f& origin,
+		                       const Eigen::Vector2f& direction,
+		                       const Eigen::Vector2f& inv_direction) {
 	// Size of the grid
 	m_size = grid.size();
 
@@ -16,7 +27,7 @@ RayTraversal::RayTraversal(const Grid2d& grid,
 		sign[i] = direction[i] < 0;
 
 	// Ray parameter delta
-	m_t_delta = grid.voxel_size() * direction.cwiseAbs().cwiseInverse();
+	m_t_delta = grid.voxel_size() * inv_direction.cwiseAbs();
 
 	// Index delta
 	for(int i = 0; i < 2; ++i)
@@ -44,7 +55,6 @@ RayTraversal::RayTraversal(const Grid2d& grid,
 	}
 	else {
 		// Do we intersects the grid at all ?
-		Eigen::Vector2f inv_direction = direction.cwiseInverse();
 		Eigen::Vector2f t_lo =  (grid_bounds[0] - origin).cwiseProduct(inv_direction);
 		Eigen::Vector2f t_hi =  (grid_bounds[1] - origin).cwiseProduct(inv_direction);
 
@@ -93,7 +103,8 @@ RayTraversal::RayTraversal(const Grid2d& grid,
 
 	}
 
-	// Ray parameter
+	// Ray parameter, divided rather than multiplied by the reciprocal which
+	// would round differently and move a few pixels
 	for(int i = 0; i < 2; ++i)
 		m_t[i] = (grid.voxel_size() * bounds[1 - sign[i]][i] - origin(i)) / direction(i);
 
@@ -102,3 +113,151 @@ RayTraversal::RayTraversal(const Grid2d& grid,
 		m_axis_init = axis();
 	}
 }
+
+
+
+int
+RayTraversal::remaining_count(const Eigen::Vector2f& t,
+                              const Eigen::Vector2f& t_delta,
+                              const Eigen::Vector2i& index,
+                              const Eigen::Vector2i& index_delta,
+                              const Eigen::Vector2i& size) {
+	// Number of steps along each axis to leave the grid, and when it happens
+	int step_count[2];
+	float t_exit[2];
+	for(int i = 0; i < 2; ++i) {
+		if (index_delta[i] == 0) {
+			step_count[i] = 0;
+			t_exit[i] = std::numeric_limits<float>::infinity();
+		}
+		else {
+			step_count[i] = index_delta[i] > 0 ? size[i] - index[i] : index[i] + 1;
+			t_exit[i] = t[i] + (step_count[i] - 1) * t_delta[i];
+		}
+	}
+
+	// The ray leaves the grid along the exit axis, after stepping along the
+	// other axis. On a tie, the traversal steps along axis 0 first : steps
+	// along axis 0 at the exit distance are taken, those along axis 1 are not.
+	int exit_axis = t_exit[1] < t_exit[0] ? 1 : 0;
+	int other_axis = 1 - exit_axis;
+
+	int other_step_count = 0;
+	if ((index_delta[other_axis] != 0) and (t[other_axis] <= t_exit[exit_axis])) {
+		float step_span = (t_exit[exit_axis] - t[other_axis]) / t_delta[other_axis];
+		int step_count_before_exit = other_axis == 0 ? int(std::floor(step_span)) + 1 : int(std::ceil(step_span));
+		other_step_count = std::min(step_count[other_axis] - 1, step_count_before_exit);
+	}
+
+	return std::max(1, step_count[exit_axis] + other_step_count);
+}
+
+
+
+RayPacketTraversal::RayPacketTraversal(const Grid2d& grid,
+                                       const Eigen::Vector2f& origin,
+                                       const Eigen::Vector2f* direction_list,
+                                       const Eigen::Vector2f* inv_direction_list) :
+	m_w(grid.size().x()),
+	m_h(grid.size().y()),
+	m_mask(0) {
+	// Setup each lane as a single ray traversal, then swizzle it
+	for(int k = 0; k < size; ++k) {
+		RayTraversal traversal(grid, origin, direction_list[k], inv_direction_list[k]);
+
+		m_t_init[k] = traversal.m_t_init;
+		m_axis_init[k] = traversal.m_axis_init;
+		m_t_x[k] = traversal.m_t.x();
+		m_t_y[k] = traversal.m_t.y();
+		m_t_delta_x[k] = traversal.m_t_delta.x();
+		m_t_delta_y[k] = traversal.m_t_delta.y();
+		m_i[k] = traversal.m_index.x();
+		m_j[k] = traversal.m_index.y();
+		m_i_delta[k] = traversal.m_index_delta.x();
+		m_j_delta[k] = traversal.m_index_delta.y();
+
+		if (traversal.has_next())
+			m_mask |= 1 << k;
+	}
+}
+
+
+
+float
+RayTraversal::block_exit_distance(int level) const {
+	int step_count[2];
+	float t_exit[2];
+	block_exit(level, step_count, t_exit);
+
+	return t_exit[1] < t_exit[0] ? t_exit[1] : t_exit[0];
+}
+
+
+
+int
+RayTraversal::skip_block(int level, float& distance, int& axis) {
+	// The ray parameters are stepped one delta at a time, as next() does, so
+	// that they round exactly as for the unskipped traversal. Jumping to
+	// t + n * t_delta may round to a different value. Each axis is stepped on
+	// its own, without choosing an axis at every cell.
+
+	// Number of steps along each axis to leave the block, and when it happens
+	int step_count[2];
+	float t_exit[2];
+	for(int i = 0; i < 2; ++i) {
+		if (m_index_delta[i] == 0) {
+			step_count[i] = 0;
+			t_exit[i] = std::numeric_limits<float>::infinity();
+		}
+		else {
+			int block_start = (m_index[i] >> level) << level;
+			step_count[i] = m_index_delta[i] > 0 ? block_start + (1 << level) - m_index[i] : m_index[i] - block_start + 1;
+
+			t_exit[i] = m_t[i];
+			for(int k = 1; k < step_count[i]; ++k)
+				t_exit[i] += m_t_delta[i];
+		}
+	}
+
+	// The ray leaves the block along the exit axis, after stepping along the
+	// other axis. On a tie, the traversal steps along axis 0 first.
+	int exit_axis = t_exit[1] < t_exit[0] ? 1 : 0;
+	int other_axis = 1 - exit_axis;
+
+	int other_step_count = 0;
+	float t_other = m_t[other_axis];
+	while ((t_other < t_exit[exit_axis]) or ((other_axis == 0) and (t_other == t_exit[exit_axis]))) {
+		t_other += m_t_delta[other_axis];
+		++other_step_count;
+	}
+
+	// Step to the cell past the block exit
+	distance = t_exit[exit_axis];
+	axis = exit_axis;
+
+	m_t[exit_axis] = t_exit[exit_axis] + m_t_delta[exit_axis];
+	m_index[exit_axis] += step_count[exit_axis] * m_index_delta[exit_axis];
+
+	m_t[other_axis] = t_other;
+	m_index[other_axis] += other_step_count * m_index_delta[other_axis];
+
+	return step_count[exit_axis] + other_step_count;
+}
+
+
+
+void
+RayTraversal::block_exit(int level, int step_count[2], float t_exit[2]) const {
+	// Number of steps along each axis to leave the block, and when it happens
+	for(int i = 0; i < 2; ++i) {
+		if (m_index_delta[i] == 0) {
+			step_count[i] = 0;
+			t_exit[i] = std::numeric_limits<float>::infinity();
+		}
+		else {
+			int block_start = (m_index[i] >> level) << level;
+			step_count[i] = m_index_delta[i] > 0 ? block_start + (1 << level) - m_index[i] : m_index[i] - block_start + 1;
+			t_exit[i] = m_t[i] + (step_count[i] - 1) * m_t_delta[i];
+		}
+	}
+}
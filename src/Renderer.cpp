@@ -1,5 +1,9 @@
 #include "SDL.h"
 #include "Renderer.h"
+#include "AllocationCounter.h"
+#include <cstdlib>
+#include <limits>
+#include <new>
 
 using namespace reb;
 
@@ -16,7 +20,8 @@ Renderer::Column::Column() :
 	m_u_end(0),
 	m_v_start(0),
 	m_v_end(0),
-	m_texture_id(0) { }
+	m_texture_id(0),
+	m_plane_height(0) { }
 
 
 
@@ -24,7 +29,8 @@ Renderer::Column::Column(float y_start, float y_end,
 			                   float z_start, float z_end,
 			                   float u_start, float u_end,
 			                   float v_start, float v_end,
-			                   unsigned int texture_id) :
+			                   unsigned int texture_id,
+			                   std::uint32_t plane_height) :
 	m_y_start(y_start),
 	m_y_end(y_end),
 	m_z_start(z_start),
@@ -33,7 +39,8 @@ Renderer::Column::Column(float y_start, float y_end,
 	m_u_end(u_end),
 	m_v_start(v_start),
 	m_v_end(v_end),
-	m_texture_id(texture_id) { }
+	m_texture_id(texture_id),
+	m_plane_height(plane_height) { }
 
 
 
@@ -73,15 +80,28 @@ Renderer::Column::clip(float y_lo, float y_hi) {
 
 // --- Renderer::CoverageBuffer -----------------------------------------------
 
-Renderer::CoverageBuffer::CoverageBuffer(int size) :
-	m_size(size) {
-	m_unoccluded_range_list.push_back(IntegerRange(0, m_size));
+Renderer::CoverageBuffer::CoverageBuffer(int size, Arena& arena) :
+	m_size(size),
+	m_timed(false),
+	m_add_time(0),
+	m_column_count(0),
+	m_column_list(arena.allocate<Column>(2 * size)),
+	m_unoccluded_range_count(0),
+	m_unoccluded_range_list(arena.allocate<IntegerRange>(size + 1)) {
+	clear();
+}
+
+
+
+Arena::size_type
+Renderer::CoverageBuffer::footprint(int size) {
+	return Arena::footprint<Column>(2 * size) + Arena::footprint<IntegerRange>(size + 1);
 }
 
 
 
 void
-Renderer::CoverageBuffer::add(Column& column) {
+Renderer::CoverageBuffer::insert(Column& column) {
 	// If the column fragment is not within the viewport, we ignore it
 	if ((column.y_end() <= 0) or (column.y_start() >= m_size))
 		return;
@@ -91,76 +111,121 @@ Renderer::CoverageBuffer::add(Column& column) {
 		(int)std::ceil(column.y_start() - .5f),
 		(int)std::ceil(column.y_end()   - .5f));
 
+	// Degenerated, upside-down fragments do not cover anything
+	if (column_range.end() < column_range.start())
+		return;
+
+	// Find the unoccluded ranges [range_lo, range_hi[ which might overlap the column range
+	IntegerRange* range_begin = m_unoccluded_range_list;
+	IntegerRange* range_end   = range_begin + m_unoccluded_range_count;
+
+	IntegerRange* range_lo =
+		std::lower_bound(range_begin, range_end, column_range.start(),
+		                 [](const IntegerRange& range, int y) { return range.end() < y; });
+	IntegerRange* range_hi =
+		std::lower_bound(range_lo, range_end, column_range.end(),
+		                 [](const IntegerRange& range, int y) { return range.start() < y; });
+
 	// Split and clip the non-occluded parts of the column fragment
-	for(const IntegerRange& range : m_unoccluded_range_list) {
-		if ((range.end() > column_range.start()) and (range.start() < column_range.end())) {
-			Column clipped_column = column;
+	for(const IntegerRange* it = range_lo; it != range_hi; ++it) {
+		if ((*it).end() > column_range.start()) {
+			Column& clipped_column = m_column_list[m_column_count++];
+			clipped_column = column;
 			clipped_column.clip(
-				std::max(range.start(), column_range.start()),
-				std::min(range.end(), column_range.end()));
-			m_column_list.push_back(clipped_column);
+				std::max((*it).start(), column_range.start()),
+				std::min((*it).end(), column_range.end()));
 		}
 	}
-	
+
 	/*
-	  Update the list of non-occluded ranges
+	  Update the list of non-occluded ranges : [range_lo, range_hi[ is
+	  replaced by what is left before and after the column range
 	 */
 
-	integer_range_list_type updated_unoccluded_range_list;
+	IntegerRange remaining_range_list[2];
+	int remaining_range_count = 0;
 
-	{
-		integer_range_list_type::const_iterator it = m_unoccluded_range_list.begin();
-
-		// Keep anything before the column range
-		for( ; it != m_unoccluded_range_list.end(); ++it)
-			if ((*it).end() < column_range.start())
-				updated_unoccluded_range_list.push_back(*it);
-			else {
-				if (((*it).start() < column_range.end()) and ((*it).start() < column_range.start()))
-					updated_unoccluded_range_list.push_back(IntegerRange((*it).start(), column_range.start()));
-				break;
-			}
-	
-		// Skip everything within the column range into a single range
-		for( ; it != m_unoccluded_range_list.end(); ++it)
-			if ((*it).start() >= column_range.end())
-				break;	
-			else {
-				if ((*it).end() > column_range.end())
-					updated_unoccluded_range_list.push_back(IntegerRange(column_range.end(), (*it).end()));
-			}
+	if ((range_lo != range_end) and ((*range_lo).start() < column_range.end()) and ((*range_lo).start() < column_range.start()))
+		remaining_range_list[remaining_range_count++] = IntegerRange((*range_lo).start(), column_range.start());
 
-		// Keep anything after the column range
-		for( ; it != m_unoccluded_range_list.end(); ++it)
-			updated_unoccluded_range_list.push_back(*it);
+	if ((range_hi != range_lo) and ((*(range_hi - 1)).end() > column_range.end()))
+		remaining_range_list[remaining_range_count++] = IntegerRange(column_range.end(), (*(range_hi - 1)).end());
 
-		m_unoccluded_range_list = updated_unoccluded_range_list;
-	}
+	int removed_range_count = range_hi - range_lo;
+	if (remaining_range_count > removed_range_count)
+		std::copy_backward(range_hi, range_end, range_end + (remaining_range_count - removed_range_count));
+	else if (remaining_range_count < removed_range_count)
+		std::copy(range_hi, range_end, range_lo + remaining_range_count);
+
+	std::copy(remaining_range_list, remaining_range_list + remaining_range_count, range_lo);
+	m_unoccluded_range_count += remaining_range_count - removed_range_count;
 }
 
 
 
 void
 Renderer::CoverageBuffer::clear() {
-	m_column_list.clear();
-	m_unoccluded_range_list.clear();
-	m_unoccluded_range_list.push_back(IntegerRange(0, m_size));
+	m_column_count = 0;
+	m_unoccluded_range_count = 1;
+	m_unoccluded_range_list[0] = IntegerRange(0, m_size);
+}
+
+
+
+
+// --- Renderer::Stats --------------------------------------------------------
+
+Renderer::Stats::Stats() {
+	clear();
+}
+
+
+
+void
+Renderer::Stats::clear() {
+	m_skipped_cell_count = 0;
+	m_jumped_cell_count = 0;
+	m_traversed_cell_count = 0;
+	m_fragment_count = 0;
+	m_pixel_count = 0;
+	std::fill(m_time_list, m_time_list + Profiler::STAGE_COUNT, 0.);
 }
 
 
 
+Renderer::Stats&
+Renderer::Stats::operator += (const Stats& other) {
+	m_skipped_cell_count += other.m_skipped_cell_count;
+	m_jumped_cell_count += other.m_jumped_cell_count;
+	m_traversed_cell_count += other.m_traversed_cell_count;
+	m_fragment_count += other.m_fragment_count;
+	m_pixel_count += other.m_pixel_count;
+	for(int stage = 0; stage < Profiler::STAGE_COUNT; ++stage)
+		m_time_list[stage] += other.m_time_list[stage];
+	return *this;
+}
+
+
 
 // --- Renderer ---------------------------------------------------------------
 
 Renderer::Renderer(int w,
 		               int h,
 						       SDL_Surface* texture_atlas,
-		               float focal_length) :
+		               float focal_length,
+		               int thread_count) :
 	m_w(w),
 	m_h(h),
 	m_focal_length(focal_length),
+	m_packet_traversal(false),
+	m_floor_mode(COLUMN_FLOOR_MODE),
+	m_kernel_mode(FLOAT_KERNEL_MODE),
+	m_empty_space_skipping(true),
+	m_floor_subdivision(0),
+	m_profiler(0),
 	m_texture_atlas(texture_atlas),
-	m_ray_direction_list(m_w, 3) { 
+	m_thread_pool(thread_count),
+	m_thread_stats_list(m_thread_pool.size()) { 
 	setup();
 }
 
@@ -173,9 +238,39 @@ Renderer::focal_length_from_angle(float angle) {
 
 
 
+void
+Renderer::resize(int w, int h) {
+	if ((w == m_w) and (h == m_h))
+		return;
+
+	m_w = w;
+	m_h = h;
+	setup();
+}
+
+
+
 void
 Renderer::setup() {
+	// Frame buffers
+	m_column_buffer = ArrayT<std::uint8_t>(m_w * m_h);
+	m_plane_buffer = ArrayT<std::uint32_t>(m_w * m_h);
+	std::fill(m_plane_buffer.begin(), m_plane_buffer.end(), 0);
+
+	// Room for the coverage buffers of a packet of columns
+	Arena::size_type arena_capacity =
+		Arena::footprint<CoverageBuffer>(RayPacketTraversal::size) +
+		RayPacketTraversal::size * CoverageBuffer::footprint(m_h);
+	m_arena_list.clear();
+	for(int k = 0; k < m_thread_pool.size(); ++k)
+		m_arena_list.push_back(std::unique_ptr<Arena>(new Arena(arena_capacity)));
+
 	// Compute ray directions
+	m_ray_dir_x = ArrayT<float>(m_w);
+	m_ray_dir_y = ArrayT<float>(m_w);
+	m_inv_ray_dir_x = ArrayT<float>(m_w);
+	m_inv_ray_dir_y = ArrayT<float>(m_w);
+	m_ray_direction_list.resize(m_w, 3);
 	for(int i = 0; i < m_w; ++i) {
 		Eigen::Vector2f U((i + .5f) / m_w - .5f, m_focal_length); 
 		float U_norm = U.norm();
@@ -186,183 +281,383 @@ Renderer::setup() {
 
 
 
+// Rotates the ray directions of columns [i_start, i_end[ for the current
+// frame, in a single pass over contiguous arrays
+void
+Renderer::rotate_ray_band(const Eigen::Matrix2f& rot_offset, int i_start, int i_end) {
+	const float* u = m_ray_direction_list.col(0).data();
+	const float* v = m_ray_direction_list.col(1).data();
+	float r00 = rot_offset(0, 0), r01 = rot_offset(0, 1);
+	float r10 = rot_offset(1, 0), r11 = rot_offset(1, 1);
+
+	for(int i = i_start; i < i_end; ++i) {
+		m_ray_dir_x[i] = r00 * u[i] + r01 * v[i];
+		m_ray_dir_y[i] = r10 * u[i] + r11 * v[i];
+	}
+
+	for(int i = i_start; i < i_end; ++i) {
+		m_inv_ray_dir_x[i] = 1.f / m_ray_dir_x[i];
+		m_inv_ray_dir_y[i] = 1.f / m_ray_dir_y[i];
+	}
+}
+
+
+
 void
 Renderer::fill_coverage_buffer(CoverageBuffer& coverage_buffer,
+                        Stats& stats,
                         const Map& map,
                         const Grid2d& grid,
 		                    const Eigen::Vector2f& ray_pos,
                         const Eigen::Vector2f& ray_dir,
+                        const Eigen::Vector2f& inv_ray_dir,
                         float ray_norm,
                         float view_height) {
 	bool column_completed = false;
 
 	// Ray/grid intersection setup
-	RayTraversal traversal(grid, ray_pos, ray_dir);
+	traversal_type traversal(grid, ray_pos, ray_dir, inv_ray_dir);
 	float prev_dist = traversal.distance_init();
-	float prev_axis = traversal.axis_init();
+	int prev_axis = traversal.axis_init();
+
+	// Empty space skipping state
+	int unoccluded_end = -1;
+	float hidden_distance = 0;
+
+	// The cells are read through a cursor following the traversal
+	Map::cell_array_type::Cursor cell_cursor(map.cell_array(), traversal.i(), traversal.j());
+	int index_delta[2] = { traversal.index_delta(0), traversal.index_delta(1) };
 
 	// If the ray origin is inside the map render the piece of floor under it
 	if (grid.is_inside(ray_pos)) {
-		const Map::Cell& cell = map.cell_array()(traversal.i(), traversal.j());
-		float cell_height = cell.height() / 256.f;
-
-		if (cell_height < view_height) {
-			float y_start = cell_height;
-			float y_end   = cell_height;
-					
-			float u_start, v_start;
-			u_start = ray_pos[1-prev_axis] + prev_dist * ray_dir[1-prev_axis];
-			u_start = u_start - std::floor(u_start);
-			v_start = ray_dir[prev_axis] > 0 ? 1 : 0;
-			if (prev_axis == 1)
-				std::swap(u_start, v_start);
-
-			float dist = 2 * ray_norm * (view_height - cell_height);
-			float u_end = ray_pos[1-prev_axis] + dist * ray_dir[1-prev_axis];
-			u_end = u_end - std::floor(u_end);
-			float v_end = ray_pos[prev_axis] + dist * ray_dir[prev_axis];
-			v_end = v_end - std::floor(v_end);
-			if (prev_axis == 1)
-				std::swap(u_end, v_end);
-
-			// Projection to screen space
-			float k = -ray_norm / dist; 
-			y_end   = m_h * (k * (y_end - view_height) + .5f); 
-
-			k = -ray_norm / prev_dist; 
-			y_start = m_h * (k * (y_start - view_height) + .5f);
-
-			// Add the column fragment
-			Column column(y_start, y_end, prev_dist, dist, u_start, u_end, v_start, v_end, cell.floor_texture_id() & 0xff);
-			coverage_buffer.add(column);	
-		}
-
-		if (view_height < 0) {
-			float y_start = 0;
-			float y_end   = 0;
-
-			float u_end, v_end;
-			u_end = ray_pos[1-prev_axis] + prev_dist * ray_dir[1-prev_axis];
-			u_end = u_end - std::floor(u_end);
-			v_end = ray_dir[prev_axis] > 0 ? 1 : 0;
-			if (prev_axis == 1)
-				std::swap(u_end, v_end);			
-			
-			float dist = 2 * ray_norm * -view_height;
-			float u_start = ray_pos[1-prev_axis] + dist * ray_dir[1-prev_axis];
-			u_start = u_start - std::floor(u_start);
-			float v_start = ray_pos[prev_axis] + dist * ray_dir[prev_axis];
-			v_start = v_start - std::floor(v_start);
-			if (prev_axis == 1)
-				std::swap(u_start, v_start);
-
-			// Projection to screen space
-			float k = -ray_norm / prev_dist; 
-			y_end = m_h * (k * (y_end - view_height) + .5f); 
-
-			k = -ray_norm / dist; 
-			y_start = m_h * (k * (y_start - view_height) + .5f);
-
-			// Add the column fragment
-			Column column(y_start, y_end, dist, prev_dist, u_start, u_end, v_start, v_end, cell.floor_texture_id() & 0xff);
-			coverage_buffer.add(column);
-		}
+		stats.traversed_cell_count() += 1;
+		add_origin_cell_fragments(coverage_buffer,
+		                          *cell_cursor,
+		                          ray_pos, ray_dir, ray_norm, view_height,
+		                          prev_dist, prev_axis);
 	}
 
 	// For each intersection found with the grid
 	for( ; traversal.has_next() and !column_completed; traversal.next()) {
+		// Jump over the blocks of cells hidden behind the fragments added so far
+		if (m_empty_space_skipping and (view_height > 0)) {
+			// The ground is hidden up to the distance where it projects at the bottom
+			// end of the unoccluded ranges, with a pixel of margin for rounding errors
+			if (coverage_buffer.unoccluded_end() != unoccluded_end) {
+				unoccluded_end = coverage_buffer.unoccluded_end();
+				float y_offset = (unoccluded_end + 1.5f) / m_h - .5f;
+				hidden_distance = y_offset > 0 ? ray_norm * view_height / y_offset : std::numeric_limits<float>::infinity();
+			}
+
+			while(prev_dist < hidden_distance) {
+				int level = hidden_block_level(map, traversal, hidden_distance, view_height);
+				if (level == 0)
+					break;
+
+				stats.jumped_cell_count() += traversal.skip_block(level, prev_dist, prev_axis);
+				cell_cursor.seek(traversal.i(), traversal.j());
+				if (!traversal.has_next())
+					break;
+			}
+
+			if (!traversal.has_next())
+				break;
+		}
+
 		float dist = traversal.distance(); 
 		int axis = traversal.axis();
-		const Map::Cell& cell = map.cell_array()(traversal.i(), traversal.j());
-		float cell_height = cell.height() / 256.f;
-
-		// Generate a column for the cell top (ie. floor)
-		if (cell_height < view_height) {
-			float y_start = cell_height;
-			float y_end   = cell_height;
-
-			float u_start, v_start;
-			u_start = ray_pos[1-axis] + dist * ray_dir[1-axis];
-			u_start = u_start - std::floor(u_start);
-			v_start = ray_dir[axis] > 0 ? 1 : 0;
-			if (axis == 1)
-				std::swap(u_start, v_start);			
-					
-			float u_end, v_end;
-			u_end = ray_pos[1-prev_axis] + prev_dist * ray_dir[1-prev_axis];
-			u_end = u_end - std::floor(u_end);
-			v_end = ray_dir[prev_axis] > 0 ? 0 : 1;
-			if (prev_axis == 1)
-				std::swap(u_end, v_end);
-
-			// Projection to screen space
-			float k = -ray_norm / prev_dist; 
-			y_end = m_h * (k * (y_end - view_height) + .5f);
-
-			k = -ray_norm / dist; 
-			y_start = m_h * (k * (y_start - view_height) + .5f); 
-
-			// Add the column fragment
-			Column column(y_start, y_end, dist, prev_dist, u_start, u_end, v_start, v_end, cell.floor_texture_id() & 0xff);
-			coverage_buffer.add(column);
-		}
+		stats.traversed_cell_count() += 1;
+		add_cell_fragments(coverage_buffer,
+		                   *cell_cursor,
+		                   ray_pos, ray_dir, ray_norm, view_height,
+		                   prev_dist, prev_axis, dist, axis);
+
+		prev_axis = axis;
+		prev_dist = dist;
 
-		// Generate a column for the cell bottom (ie. ceiling)
-		if (view_height < 0) {
-			float y_start = 0;
-			float y_end   = 0;
-
-			float u_start, v_start;
-			u_start = ray_pos[1-prev_axis] + prev_dist * ray_dir[1-prev_axis];
-			u_start = u_start - std::floor(u_start);
-			v_start = ray_dir[prev_axis] > 0 ? 0 : 1;
-			if (prev_axis == 1)
-				std::swap(u_start, v_start);			
-					
-			float u_end, v_end;
-			u_end = ray_pos[1-axis] + dist * ray_dir[1-axis];
-			u_end = u_end - std::floor(u_end);
-			v_end = ray_dir[axis] > 0 ? 1 : 0;
-			if (axis == 1)
-				std::swap(u_end, v_end);
-
-			// Projection to screen space
-			float k = -ray_norm / prev_dist; 
-			y_start = m_h * (k * (y_start - view_height) + .5f); 
-
-			k = -ray_norm / dist; 
-			y_end = m_h * (k * (y_end - view_height) + .5f);
-
-			// Add the column fragment
-			Column column(y_start, y_end, prev_dist, dist, u_start, u_end, v_start, v_end, cell.floor_texture_id() & 0xff);
-			coverage_buffer.add(column);
+		// Stop the ray once the column is fully covered
+		if (coverage_buffer.is_complete()) {
+			column_completed = true;
+			stats.skipped_cell_count() += traversal.remaining_count() - 1;
 		}
 
-		// Generate a column for cell side (ie. wall)
-		{
-			// Compute the wall slice
-			float y_start = cell_height;
-			float y_end   = 0;
+		// Follow the traversal to the next cell
+		cell_cursor.step(axis, index_delta[axis]);
+	}
+}
+
+
+
+void
+Renderer::fill_coverage_buffer_packet(CoverageBuffer* coverage_buffer_list,
+                                      Stats& stats,
+                                      const Map& map,
+                                      const Grid2d& grid,
+                                      const Eigen::Vector2f& ray_pos,
+                                      const Eigen::Vector2f* ray_dir_list,
+                                      const Eigen::Vector2f* inv_ray_dir_list,
+                                      const float* ray_norm_list,
+                                      float view_height) {
+	// Ray/grid intersection setup
+	RayPacketTraversal traversal(grid, ray_pos, ray_dir_list, inv_ray_dir_list);
+
+	float prev_dist[RayPacketTraversal::size];
+	int prev_axis[RayPacketTraversal::size];
+	for(int k = 0; k < RayPacketTraversal::size; ++k) {
+		prev_dist[k] = traversal.distance_init(k);
+		prev_axis[k] = traversal.axis_init(k);
+	}
+
+	// The cells of each lane are read through a cursor following the traversal
+	Map::cell_array_type::Cursor cell_cursor_list[RayPacketTraversal::size];
+	for(int k = 0; k < RayPacketTraversal::size; ++k)
+		cell_cursor_list[k] = Map::cell_array_type::Cursor(map.cell_array(), traversal.i(k), traversal.j(k));
+
+	// If the ray origin is inside the map render the piece of floor under it
+	if (grid.is_inside(ray_pos)) {
+		stats.traversed_cell_count() += RayPacketTraversal::size;
+		for(int k = 0; k < RayPacketTraversal::size; ++k)
+			add_origin_cell_fragments(coverage_buffer_list[k],
+			                          *cell_cursor_list[k],
+			                          ray_pos, ray_dir_list[k], ray_norm_list[k], view_height,
+			                          prev_dist[k], prev_axis[k]);
+	}
+
+	// For each intersection found with the grid, lane by lane
+	RayPacketTraversal::HitList hit_list;
+	for( ; traversal.mask(); traversal.next()) {
+		traversal.hits(hit_list);
+
+		for(int k = 0; k < RayPacketTraversal::size; ++k) {
+			if (!(traversal.mask() & (1 << k)))
+				continue;
 
-			float u_start = ray_pos[1 - prev_axis] + prev_dist * ray_dir[1 - prev_axis];
-			u_start -= std::floor(u_start);
-			float u_end = u_start;
+			stats.traversed_cell_count() += 1;
+			add_cell_fragments(coverage_buffer_list[k],
+			                   *cell_cursor_list[k],
+			                   ray_pos, ray_dir_list[k], ray_norm_list[k], view_height,
+			                   prev_dist[k], prev_axis[k], hit_list.distance[k], hit_list.axis[k]);
 
-			float v_start = 0;
-			float v_end   = cell_height;
+			prev_axis[k] = hit_list.axis[k];
+			prev_dist[k] = hit_list.distance[k];
 
-			// Projection to screen space
-			float k = -ray_norm / prev_dist; 
-			y_start = m_h * (k * (y_start - view_height) + .5f); 
-			y_end   = m_h * (k * (y_end   - view_height) + .5f); 
+			// Stop the lane once the column is fully covered
+			if (coverage_buffer_list[k].is_complete()) {
+				traversal.deactivate(k);
+				stats.skipped_cell_count() += traversal.remaining_count(k) - 1;
+			}
 
-			// Add the column fragment
-			Column column(y_start, y_end, prev_dist, prev_dist, u_start, u_end, v_start, v_end, cell.wall_texture_id() & 0xff);
-			coverage_buffer.add(column);
+			// Follow the traversal to the next cell
+			cell_cursor_list[k].step(hit_list.axis[k], traversal.index_delta(k, hit_list.axis[k]));
 		}
+	}
+}
 
-		prev_axis = axis;
-		prev_dist = dist;
+
+
+// Level of the largest block of cells around the current cell whose cells
+// would only generate hidden fragments, 0 if there is none
+int
+Renderer::hidden_block_level(const Map& map,
+                             const traversal_type& traversal,
+                             float hidden_distance,
+                             float view_height) const {
+	// Find the largest block around the current cell with only hidden fragments
+	int hidden_level = 0;
+	for(int level = 1; level <= map.max_height_level_count(); ++level) {
+		// A cell at or above the eye is always seen from below or from the side
+		float block_height = map.max_height(level, traversal.i(), traversal.j()) / 256.f;
+		if (block_height >= view_height)
+			break;
+
+		// The top of the highest cell of the block has to be hidden up to the block exit
+		if (traversal.block_exit_distance(level) > hidden_distance * ((view_height - block_height) / view_height))
+			break;
+
+		hidden_level = level;
+	}
+
+	return hidden_level;
+}
+
+
+
+// Generates the column fragments for the floor of the cell holding the ray origin
+void
+Renderer::add_origin_cell_fragments(CoverageBuffer& coverage_buffer,
+                                    const Map::Cell& cell,
+                                    const Eigen::Vector2f& ray_pos,
+                                    const Eigen::Vector2f& ray_dir,
+                                    float ray_norm,
+                                    float view_height,
+                                    float prev_dist,
+                                    int prev_axis) {
+
+	float cell_height = cell.height() / 256.f;
+
+	if (cell_height < view_height) {
+		float y_start = cell_height;
+		float y_end   = cell_height;
+				
+		float u_start, v_start;
+		u_start = ray_pos[1-prev_axis] + prev_dist * ray_dir[1-prev_axis];
+		u_start = u_start - std::floor(u_start);
+		v_start = ray_dir[prev_axis] > 0 ? 1 : 0;
+		if (prev_axis == 1)
+			std::swap(u_start, v_start);
+
+		float dist = 2 * ray_norm * (view_height - cell_height);
+		float u_end = ray_pos[1-prev_axis] + dist * ray_dir[1-prev_axis];
+		u_end = u_end - std::floor(u_end);
+		float v_end = ray_pos[prev_axis] + dist * ray_dir[prev_axis];
+		v_end = v_end - std::floor(v_end);
+		if (prev_axis == 1)
+			std::swap(u_end, v_end);
+
+		// Projection to screen space
+		float k = -ray_norm / dist; 
+		y_end   = m_h * (k * (y_end - view_height) + .5f); 
+
+		k = -ray_norm / prev_dist; 
+		y_start = m_h * (k * (y_start - view_height) + .5f);
+
+		// Add the column fragment
+		Column column(y_start, y_end, prev_dist, dist, u_start, u_end, v_start, v_end, cell.floor_texture_id(), cell.height());
+		coverage_buffer.add(column);	
+	}
+
+	if (view_height < 0) {
+		float y_start = 0;
+		float y_end   = 0;
+
+		float u_end, v_end;
+		u_end = ray_pos[1-prev_axis] + prev_dist * ray_dir[1-prev_axis];
+		u_end = u_end - std::floor(u_end);
+		v_end = ray_dir[prev_axis] > 0 ? 1 : 0;
+		if (prev_axis == 1)
+			std::swap(u_end, v_end);			
+		
+		float dist = 2 * ray_norm * -view_height;
+		float u_start = ray_pos[1-prev_axis] + dist * ray_dir[1-prev_axis];
+		u_start = u_start - std::floor(u_start);
+		float v_start = ray_pos[prev_axis] + dist * ray_dir[prev_axis];
+		v_start = v_start - std::floor(v_start);
+		if (prev_axis == 1)
+			std::swap(u_start, v_start);
+
+		// Projection to screen space
+		float k = -ray_norm / prev_dist; 
+		y_end = m_h * (k * (y_end - view_height) + .5f); 
+
+		k = -ray_norm / dist; 
+		y_start = m_h * (k * (y_start - view_height) + .5f);
+
+		// Add the column fragment
+		Column column(y_start, y_end, dist, prev_dist, u_start, u_end, v_start, v_end, cell.floor_texture_id(), 0);
+		coverage_buffer.add(column);
+	}
+}
+
+
+
+// Generates the column fragments for a cell entered at distance prev_dist
+// and left at distance dist
+void
+Renderer::add_cell_fragments(CoverageBuffer& coverage_buffer,
+                             const Map::Cell& cell,
+                             const Eigen::Vector2f& ray_pos,
+                             const Eigen::Vector2f& ray_dir,
+                             float ray_norm,
+                             float view_height,
+                             float prev_dist,
+                             int prev_axis,
+                             float dist,
+                             int axis) {
+	float cell_height = cell.height() / 256.f;
+
+	// Generate a column for the cell top (ie. floor)
+	if (cell_height < view_height) {
+		float y_start = cell_height;
+		float y_end   = cell_height;
+
+		float u_start, v_start;
+		u_start = ray_pos[1-axis] + dist * ray_dir[1-axis];
+		u_start = u_start - std::floor(u_start);
+		v_start = ray_dir[axis] > 0 ? 1 : 0;
+		if (axis == 1)
+			std::swap(u_start, v_start);			
+				
+		float u_end, v_end;
+		u_end = ray_pos[1-prev_axis] + prev_dist * ray_dir[1-prev_axis];
+		u_end = u_end - std::floor(u_end);
+		v_end = ray_dir[prev_axis] > 0 ? 0 : 1;
+		if (prev_axis == 1)
+			std::swap(u_end, v_end);
+
+		// Projection to screen space
+		float k = -ray_norm / prev_dist; 
+		y_end = m_h * (k * (y_end - view_height) + .5f);
+
+		k = -ray_norm / dist; 
+		y_start = m_h * (k * (y_start - view_height) + .5f); 
+
+		// Add the column fragment
+		Column column(y_start, y_end, dist, prev_dist, u_start, u_end, v_start, v_end, cell.floor_texture_id(), cell.height());
+		coverage_buffer.add(column);
+	}
+
+	// Generate a column for the cell bottom (ie. ceiling)
+	if (view_height < 0) {
+		float y_start = 0;
+		float y_end   = 0;
+
+		float u_start, v_start;
+		u_start = ray_pos[1-prev_axis] + prev_dist * ray_dir[1-prev_axis];
+		u_start = u_start - std::floor(u_start);
+		v_start = ray_dir[prev_axis] > 0 ? 0 : 1;
+		if (prev_axis == 1)
+			std::swap(u_start, v_start);			
+				
+		float u_end, v_end;
+		u_end = ray_pos[1-axis] + dist * ray_dir[1-axis];
+		u_end = u_end - std::floor(u_end);
+		v_end = ray_dir[axis] > 0 ? 1 : 0;
+		if (axis == 1)
+			std::swap(u_end, v_end);
+
+		// Projection to screen space
+		float k = -ray_norm / prev_dist; 
+		y_start = m_h * (k * (y_start - view_height) + .5f); 
+
+		k = -ray_norm / dist; 
+		y_end = m_h * (k * (y_end - view_height) + .5f);
+
+		// Add the column fragment
+		Column column(y_start, y_end, prev_dist, dist, u_start, u_end, v_start, v_end, cell.floor_texture_id(), 0);
+		coverage_buffer.add(column);
+	}
+
+	// Generate a column for cell side (ie. wall)
+	{
+		// Compute the wall slice
+		float y_start = cell_height;
+		float y_end   = 0;
+
+		float u_start = ray_pos[1 - prev_axis] + prev_dist * ray_dir[1 - prev_axis];
+		u_start -= std::floor(u_start);
+		float u_end = u_start;
+
+		float v_start = 0;
+		float v_end   = cell_height;
+
+		// Projection to screen space
+		float k = -ray_norm / prev_dist; 
+		y_start = m_h * (k * (y_start - view_height) + .5f); 
+		y_end   = m_h * (k * (y_end   - view_height) + .5f); 
+
+		// Add the column fragment
+		Column column(y_start, y_end, prev_dist, prev_dist, u_start, u_end, v_start, v_end, cell.wall_texture_id());
+		coverage_buffer.add(column);
 	}
 }
 
@@ -382,43 +677,342 @@ Renderer::render(SDL_Surface* dst,
 	Eigen::Matrix2f rot_offset;
 	rot_offset = Eigen::Rotation2Df(angle);
 
-	// Clear the surface
-	SDL_FillRect(dst, NULL, 149);
+#ifdef REBLOCHON_ALLOCATION_CHECK
+	std::uint64_t allocation_count = AllocationCounter::count();
+#endif
+
+	// Each thread renders a contiguous band of columns, with its own coverage
+	// buffers, then copies it to the surface
+	auto render_band = [&](int thread_index) {
+		int i_start = (m_w * thread_index) / m_thread_pool.size();
+		int i_end   = (m_w * (thread_index + 1)) / m_thread_pool.size();
+
+		// Release the transient storage of the previous frame
+		Arena& arena = *m_arena_list[thread_index];
+		arena.reset();
+
+		CoverageBuffer* coverage_buffer_list = arena.allocate<CoverageBuffer>(RayPacketTraversal::size);
+		for(int k = 0; k < RayPacketTraversal::size; ++k)
+			new (coverage_buffer_list + k) CoverageBuffer(m_h, arena);
+
+		Stats& stats = m_thread_stats_list[thread_index];
+		stats.clear();
+		render_column_band(dst, coverage_buffer_list, stats, thread_index, i_start, i_end, map, grid, rot_offset, ray_pos, pos.z());
+	};
+
+	m_thread_pool.run(render_band);
+
+	// Each thread renders the floor spans of a contiguous band of rows
+	if (m_floor_mode == SCANLINE_FLOOR_MODE) {
+		auto render_spans = [&](int thread_index) {
+			int j_start = (m_h * thread_index) / m_thread_pool.size();
+			int j_end   = (m_h * (thread_index + 1)) / m_thread_pool.size();
+			Tracer::Scope trace_scope(m_profiler ? m_profiler->tracer() : 0, thread_index, "spans");
+			Profiler::Stopwatch stopwatch(m_profiler != 0);
+			render_span_band(dst, m_thread_stats_list[thread_index], j_start, j_end, map, grid, rot_offset, ray_pos, pos.z());
+			m_thread_stats_list[thread_index].time(Profiler::SPAN_STAGE) += stopwatch.lap();
+		};
+
+		m_thread_pool.run(render_spans);
+	}
+
+	// Gather the counters of each thread
+	m_stats.clear();
+	for(const Stats& stats : m_thread_stats_list)
+		m_stats += stats;
 
-	// For each column
-	CoverageBuffer coverage_buffer(m_h);
-	for(int i = 0; i < m_w; ++i) {
-		// Compute ray direction
+	if (m_profiler) {
+		for(int stage = 0; stage < Profiler::STAGE_COUNT; ++stage)
+			m_profiler->add(Profiler::Stage(stage), m_stats.time(Profiler::Stage(stage)) / m_thread_pool.size());
+
+		m_profiler->add(Profiler::CELL_COUNTER, m_stats.traversed_cell_count());
+		m_profiler->add(Profiler::FRAGMENT_COUNTER, m_stats.fragment_count());
+		m_profiler->add(Profiler::PIXEL_COUNTER, m_stats.pixel_count());
+	}
+
+#ifdef REBLOCHON_ALLOCATION_CHECK
+	// Rendering a frame should not touch the heap
+	if (AllocationCounter::count() != allocation_count) {
+		SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "Rendering a frame allocated memory\n");
+		std::abort();
+	}
+#endif
+}
+
+
+
+void
+Renderer::render_column_band(SDL_Surface* dst,
+                             CoverageBuffer* coverage_buffer_list,
+                             Stats& stats,
+                             int thread_index,
+                             int i_start, int i_end,
+                             const Map& map,
+                             const Grid2d& grid,
+                             const Eigen::Matrix2f& rot_offset,
+                             const Eigen::Vector2f& ray_pos,
+                             float view_height) {
+	/*
+	  Timing every coverage buffer insertion would cost as much as the
+	  insertions themselves : only one column out of coverage_sampling_period
+	  is timed, and the total is extrapolated from those columns
+	 */
+
+	const int coverage_sampling_period = 16;
+	bool profiled = m_profiler != 0;
+	Tracer* tracer = profiled ? m_profiler->tracer() : 0;
+	Profiler::Stopwatch stopwatch(profiled);
+	double fill_time = 0;
+	double sampled_add_time = 0;
+	int sampled_column_count = 0;
+
+	// Clear the band
+	{
+		Tracer::Scope trace_scope(tracer, thread_index, "clear");
+		std::fill(column_pixels(i_start), column_pixels(i_end), 149);
+	}
+	stats.time(Profiler::CLEAR_STAGE) += stopwatch.lap();
+
+	// Traversal, coverage and drawing are interleaved column by column
+	if (tracer)
+		tracer->begin(thread_index, "columns");
+
+	rotate_ray_band(rot_offset, i_start, i_end);
+	fill_time += stopwatch.lap();
+
+	int i = i_start;
+
+	// For each packet of columns
+	if (m_packet_traversal) {
+		for( ; i + RayPacketTraversal::size <= i_end; i += RayPacketTraversal::size) {
+			// Gather ray directions
+			Eigen::Vector2f ray_dir_list[RayPacketTraversal::size];
+			Eigen::Vector2f inv_ray_dir_list[RayPacketTraversal::size];
+			float ray_norm_list[RayPacketTraversal::size];
+			for(int k = 0; k < RayPacketTraversal::size; ++k) {
+				ray_norm_list[k] = m_ray_direction_list(i + k, 2);
+				ray_dir_list[k] = Eigen::Vector2f(m_ray_dir_x[i + k], m_ray_dir_y[i + k]);
+				inv_ray_dir_list[k] = Eigen::Vector2f(m_inv_ray_dir_x[i + k], m_inv_ray_dir_y[i + k]);
+				coverage_buffer_list[k].clear();
+				coverage_buffer_list[k].timed() = profiled and ((i + k) % coverage_sampling_period == 0);
+			}
+
+			// Compute all the column fragments to render
+			fill_coverage_buffer_packet(coverage_buffer_list, stats, map, grid, ray_pos, ray_dir_list, inv_ray_dir_list, ray_norm_list, view_height);
+			fill_time += stopwatch.lap();
+
+			// Render the column fragments
+			for(int k = 0; k < RayPacketTraversal::size; ++k) {
+				CoverageBuffer& coverage_buffer = coverage_buffer_list[k];
+				if (coverage_buffer.timed()) {
+					sampled_add_time += coverage_buffer.add_time();
+					sampled_column_count += 1;
+					coverage_buffer.add_time() = 0;
+				}
+
+				stats.fragment_count() += coverage_buffer.end() - coverage_buffer.begin();
+				for(const Column& column : coverage_buffer)
+					stats.pixel_count() += draw_column(i + k, column);
+			}
+			stats.time(Profiler::DRAW_STAGE) += stopwatch.lap();
+		}
+	}
+
+	// For each remaining column
+	CoverageBuffer& coverage_buffer = coverage_buffer_list[0];
+	for( ; i < i_end; ++i) {
+		// Gather ray direction
 		float ray_norm = m_ray_direction_list(i, 2);
-		Eigen::Vector2f ray_dir = m_ray_direction_list.row(i).head(2);
-		ray_dir = rot_offset * ray_dir;
-		
+		Eigen::Vector2f ray_dir(m_ray_dir_x[i], m_ray_dir_y[i]);
+		Eigen::Vector2f inv_ray_dir(m_inv_ray_dir_x[i], m_inv_ray_dir_y[i]);
+
 		// Compute all the column fragments to render
 		coverage_buffer.clear();
-		fill_coverage_buffer(coverage_buffer, map, grid, ray_pos, ray_dir, ray_norm, pos.z());
+		coverage_buffer.timed() = profiled and (i % coverage_sampling_period == 0);
+		fill_coverage_buffer(coverage_buffer, stats, map, grid, ray_pos, ray_dir, inv_ray_dir, ray_norm, view_height);
+		fill_time += stopwatch.lap();
+
+		if (coverage_buffer.timed()) {
+			sampled_add_time += coverage_buffer.add_time();
+			sampled_column_count += 1;
+			coverage_buffer.add_time() = 0;
+		}
 
 		// Render the column fragments
-		for(const Column& column : coverage_buffer.column_list())
-			draw_column(dst, i, column);
+		stats.fragment_count() += coverage_buffer.end() - coverage_buffer.begin();
+		for(const Column& column : coverage_buffer)
+			stats.pixel_count() += draw_column(i, column);
+		stats.time(Profiler::DRAW_STAGE) += stopwatch.lap();
+	}
+
+	if (tracer)
+		tracer->end(thread_index, "columns");
+
+	// Copy the band to the surface
+	{
+		Tracer::Scope trace_scope(tracer, thread_index, "transpose");
+		transpose_column_band(dst, i_start, i_end);
+	}
+	stats.time(Profiler::TRANSPOSE_STAGE) += stopwatch.lap();
+
+	// Split the time spent filling the coverage buffers
+	if (sampled_column_count > 0) {
+		double add_time = std::min(fill_time, std::max(0., sampled_add_time) * (i_end - i_start) / sampled_column_count);
+		stats.time(Profiler::COVERAGE_STAGE) += add_time;
+		stats.time(Profiler::TRAVERSAL_STAGE) += fill_time - add_time;
 	}
+	else
+		stats.time(Profiler::TRAVERSAL_STAGE) += fill_time;
 }
 
 
 
+// Draws the floor spans of rows [j_start, j_end[, each span being a run of
+// pixels on the same plane. Along a row, the depth of a plane is constant,
+// thus its world coordinates are linear in x, and are stepped in 16.16 fixed
+// point. Consumed plane tags are reset for the next frame.
 void
-Renderer::draw_column(SDL_Surface* dst, int x, const Column& column) {
-	if (column.z_start() == column.z_end())
-		draw_wall_column(dst, x, column);
+Renderer::render_span_band(SDL_Surface* dst,
+                           Stats& stats,
+                           int j_start, int j_end,
+                           const Map& map,
+                           const Grid2d& grid,
+                           const Eigen::Matrix2f& rot_offset,
+                           const Eigen::Vector2f& ray_pos,
+                           float view_height) {
+	const Map::cell_array_type& cell_array = map.cell_array();
+	const float fixed_one = 65536.f;
+	const int cell_i_max = cell_array.w() - 1;
+	const int cell_j_max = cell_array.h() - 1;
+
+	// World to grid offset
+	std::int64_t grid_offset_x = std::llround(grid.extent().x() * fixed_one);
+	std::int64_t grid_offset_y = std::llround(grid.extent().y() * fixed_one);
+
+	// Ray direction, scaled by its norm, for the first column and its increment per column
+	Eigen::Vector2f dir_start = rot_offset * Eigen::Vector2f(.5f / m_w - .5f, m_focal_length);
+	Eigen::Vector2f dir_step  = rot_offset * Eigen::Vector2f(1.f / m_w, 0.f);
+
+	for(int j = j_start; j < j_end; ++j) {
+		std::uint32_t* plane_row = m_plane_buffer.data() + j * m_w;
+		std::uint8_t* dst_row = ((std::uint8_t*)dst->pixels) + j * dst->pitch;
+
+		// Planes seen at the horizon line are infinitely far
+		float y_offset = (j + .5f) / m_h - .5f;
+		if (y_offset == 0) {
+			std::fill(plane_row, plane_row + m_w, 0);
+			continue;
+		}
+
+		for(int i = 0; i < m_w; ) {
+			std::uint32_t plane = plane_row[i];
+			if (!plane) {
+				++i;
+				continue;
+			}
+
+			// Extent of the span
+			int i_start = i;
+			for( ; (i < m_w) and (plane_row[i] == plane); ++i)
+				plane_row[i] = 0;
+			stats.pixel_count() += i - i_start;
+
+			// World coordinates at the span start, and their increment per pixel
+			float k = m_focal_length * (view_height - (plane - 1) / 256.f) / y_offset;
+			Eigen::Vector2f span_pos = ray_pos + k * (dir_start + i_start * dir_step);
+			Eigen::Vector2f span_step = k * dir_step;
+
+			std::int64_t x = std::llround(span_pos.x() * fixed_one);
+			std::int64_t y = std::llround(span_pos.y() * fixed_one);
+			std::int64_t x_delta = std::llround(span_step.x() * fixed_one);
+			std::int64_t y_delta = std::llround(span_step.y() * fixed_one);
+
+			// Fill the span
+			std::uint8_t* dst_pixel = dst_row + i_start;
+			for(int count = i - i_start; count > 0; --count, ++dst_pixel, x += x_delta, y += y_delta) {
+				int cell_i = std::min(std::max(int((x + grid_offset_x) >> 16), 0), cell_i_max);
+				int cell_j = std::min(std::max(int((y + grid_offset_y) >> 16), 0), cell_j_max);
+				const Map::Cell& cell = cell_array(cell_i, cell_j);
+
+				int u_offset = (y >> 12) & 15;
+				int v_offset = (x >> 12) & 15;
+
+				*dst_pixel = m_texture_atlas.texture(cell.floor_texture_id())[16 * u_offset + v_offset];
+			}
+		}
+	}
+}
+
+
+
+// Copies columns [i_start, i_end[ of the column-major buffer to a row-major
+// surface, block by block so that both sides stay in cache
+void
+Renderer::transpose_column_band(SDL_Surface* dst,
+                                int i_start, int i_end) {
+	const int block_size = 32;
+
+	for(int j_block = 0; j_block < m_h; j_block += block_size) {
+		int j_block_end = std::min(j_block + block_size, m_h);
+
+		for(int i_block = i_start; i_block < i_end; i_block += block_size) {
+			int i_block_end = std::min(i_block + block_size, i_end);
+
+			for(int j = j_block; j < j_block_end; ++j) {
+				std::uint8_t const* src_pixel = column_pixels(i_block) + j;
+				std::uint8_t* dst_pixel = ((std::uint8_t*)dst->pixels) + j * dst->pitch + i_block;
+				for(int i = i_block; i < i_block_end; ++i, src_pixel += m_h, ++dst_pixel)
+					*dst_pixel = *src_pixel;
+			}
+		}
+	}
+}
+
+
+
+int
+Renderer::draw_column(int x, const Column& column) {
+	bool fixed_kernel = m_kernel_mode == FIXED_KERNEL_MODE;
+
+	if (column.z_start() == column.z_end()) {
+		if (fixed_kernel)
+			draw_wall_column_fixed(column_pixels(x), column);
+		else
+			draw_wall_column(column_pixels(x), column);
+	}
+	else if (m_floor_mode == SCANLINE_FLOOR_MODE) {
+		mark_plane_column(x, column);
+		return 0;
+	}
+	else if (fixed_kernel and (m_floor_subdivision > 1))
+		draw_floor_column_fixed(column_pixels(x), column);
 	else
-		draw_floor_column(dst, x, column);
+		draw_floor_column(column_pixels(x), column);
+
+	return int(column.y_end() - column.y_start());
+}
+
+
+
+// Tags the pixels of a floor column with its plane, for the scanline pass
+void
+Renderer::mark_plane_column(int x, const Column& column) {
+	float y_delta = column.y_end() - column.y_start();
+	std::uint32_t plane = column.plane_height() + 1;
+
+	std::uint32_t* dst_plane = m_plane_buffer.data() + ((int)std::floor(column.y_start())) * m_w + x;
+
+	int i_end = y_delta;
+	for(int i = 0; i < i_end; ++i, dst_plane += m_w)
+		*dst_plane = plane;
 }
 
 
 
 // Draws a vertical column (ie. constant Z) with only U texture coordinate being interpolated
 void
-Renderer::draw_wall_column(SDL_Surface* dst,
-		                       int x, const Column& column) {
+Renderer::draw_wall_column(std::uint8_t* dst,
+		                       const Column& column) {
 	float y_delta = column.y_end() - column.y_start();
 
 	float v_delta = (column.v_end() - column.v_start()) / y_delta;
@@ -426,19 +1020,17 @@ Renderer::draw_wall_column(SDL_Surface* dst,
 
 	int u_offset = int(16 * column.u_start()) % 16;
 
-	uint8_t const* src_pixel = (uint8_t const*)m_texture_atlas->pixels;
-	src_pixel += 16 * (column.texture_id() % 16) + 16 * m_texture_atlas->pitch * (column.texture_id() / 16);
-	src_pixel += u_offset;
+	uint8_t const* src_pixel = m_texture_atlas.texture(column.texture_id());
+	src_pixel += 16 * u_offset;
 
-	uint8_t* dst_pixel = (uint8_t*)dst->pixels;
-	dst_pixel += ((int)std::floor(column.y_start())) * dst->pitch + x;
+	uint8_t* dst_pixel = dst + (int)std::floor(column.y_start());
 
 	int i_end = y_delta;
-	for(int i = 0; i < i_end; ++i, dst_pixel += dst->pitch) {
+	for(int i = 0; i < i_end; ++i, ++dst_pixel) {
 		float v = i * v_delta + v_start;
 		int v_offset = int(std::floor(16 * v)) & 15;
 
-		*dst_pixel = src_pixel[v_offset * m_texture_atlas->pitch];
+		*dst_pixel = src_pixel[v_offset];
 	}
 }
 
@@ -446,8 +1038,8 @@ Renderer::draw_wall_column(SDL_Surface* dst,
 
 // Draws an floor column
 void 
-Renderer::draw_floor_column(SDL_Surface* dst,
-		                        int x, const Column& column) {
+Renderer::draw_floor_column(std::uint8_t* dst,
+		                        const Column& column) {
 	float y_delta = column.y_end() - column.y_start();
 	float inv_y_delta = 1.f / y_delta;
 
@@ -463,21 +1055,157 @@ Renderer::draw_floor_column(SDL_Surface* dst,
 	float vw_delta = (column.v_end() / column.z_end() - vw_start) * inv_y_delta;
 	vw_start += .5f * vw_delta;
 
-	uint8_t const* src_pixel = (uint8_t const*)m_texture_atlas->pixels;
-	src_pixel += 16 * (column.texture_id() % 16) + 16 * m_texture_atlas->pitch * (column.texture_id() / 16);
+	uint8_t const* src_pixel = m_texture_atlas.texture(column.texture_id());
 
-	uint8_t* dst_pixel = (uint8_t*)dst->pixels;
-	dst_pixel += ((int)std::floor(column.y_start())) * dst->pitch + x;
+	uint8_t* dst_pixel = dst + (int)std::floor(column.y_start());
 
 	int i_end = y_delta;
-	for(int i = 0; i < i_end; ++i, dst_pixel += dst->pitch) {
-		float z = 1. / (i * w_delta + w_start);
-		float u = z * (i * uw_delta + uw_start);
-		float v = z * (i * vw_delta + vw_start);
 
-		int u_offset = int(std::floor(16 * u)) & 15;
-		int v_offset = int(std::floor(16 * v)) & 15;
+	// Exact perspective correction
+	if (m_floor_subdivision <= 1) {
+		for(int i = 0; i < i_end; ++i, ++dst_pixel) {
+			float z = 1. / (i * w_delta + w_start);
+			float u = z * (i * uw_delta + uw_start);
+			float v = z * (i * vw_delta + vw_start);
+
+			int u_offset = int(std::floor(16 * u)) & 15;
+			int v_offset = int(std::floor(16 * v)) & 15;
+
+			*dst_pixel = src_pixel[16 * u_offset + v_offset];
+		}
+
+		return;
+	}
+
+	// Perspective correction at segment ends, linear interpolation in between.
+	// The divide for the end of the next segment is issued before the pixels
+	// of the current segment, which do not depend on it, so that they hide its
+	// latency.
+	float inv_subdivision = 1.f / m_floor_subdivision;
+
+	float z = 1.f / w_start;
+	float u = z * uw_start;
+	float v = z * vw_start;
+
+	int i_next = std::min(m_floor_subdivision, i_end);
+	float z_next = 1.f / (i_next * w_delta + w_start);
+
+	for(int i = 0; i < i_end; ) {
+		float inv_count = (i_next - i == m_floor_subdivision) ? inv_subdivision : 1.f / (i_next - i);
+
+		float u_next = z_next * (i_next * uw_delta + uw_start);
+		float v_next = z_next * (i_next * vw_delta + vw_start);
+
+		float u_delta = (u_next - u) * inv_count;
+		float v_delta = (v_next - v) * inv_count;
+
+		int i_after = std::min(i_next + m_floor_subdivision, i_end);
+		float z_after = 1.f / (i_after * w_delta + w_start);
+
+		for( ; i < i_next; ++i, ++dst_pixel, u += u_delta, v += v_delta) {
+			int u_offset = int(std::floor(16 * u)) & 15;
+			int v_offset = int(std::floor(16 * v)) & 15;
+
+			*dst_pixel = src_pixel[16 * u_offset + v_offset];
+		}
+
+		u = u_next;
+		v = v_next;
+		i_next = i_after;
+		z_next = z_after;
+	}
+}
+
+
+
+// Texture coordinates are stepped as 16.16 fixed point texel offsets, wrapping
+// modulo 2^32 as only their 4 lowest integer bits are used
+
+void
+Renderer::draw_wall_column_fixed(std::uint8_t* dst,
+		                             const Column& column) {
+	const float fixed_one = 16 * 65536.f;
+
+	float y_delta = column.y_end() - column.y_start();
+
+	float v_delta = (column.v_end() - column.v_start()) / y_delta;
+	float v_start = column.v_start() + .5f * v_delta;
+
+	int u_offset = int(16 * column.u_start()) % 16;
+
+	uint8_t const* src_pixel = m_texture_atlas.texture(column.texture_id());
+	src_pixel += 16 * u_offset;
+
+	uint8_t* dst_pixel = dst + (int)std::floor(column.y_start());
+
+	std::uint32_t v = std::uint32_t(std::llround(v_start * fixed_one));
+	std::uint32_t v_step = std::uint32_t(std::llround(v_delta * fixed_one));
+
+	int i_end = y_delta;
+	for(int i = 0; i < i_end; ++i, ++dst_pixel, v += v_step)
+		*dst_pixel = src_pixel[(v >> 16) & 15];
+}
+
+
+
+void
+Renderer::draw_floor_column_fixed(std::uint8_t* dst,
+		                              const Column& column) {
+	const float fixed_one = 16 * 65536.f;
+
+	float y_delta = column.y_end() - column.y_start();
+	float inv_y_delta = 1.f / y_delta;
+
+	float w_start = 1.f / column.z_start();
+	float w_delta = ((1.f / column.z_end()) - (1.f / column.z_start())) * inv_y_delta;
+	w_start += .5f * w_delta;
+
+	float uw_start = column.u_start() / column.z_start();
+	float uw_delta = (column.u_end() / column.z_end() - uw_start) * inv_y_delta;
+	uw_start += .5f * uw_delta;
+
+	float vw_start = column.v_start() / column.z_start();
+	float vw_delta = (column.v_end() / column.z_end() - vw_start) * inv_y_delta;
+	vw_start += .5f * vw_delta;
+
+	uint8_t const* src_pixel = m_texture_atlas.texture(column.texture_id());
+
+	uint8_t* dst_pixel = dst + (int)std::floor(column.y_start());
+
+	int i_end = y_delta;
+
+	// Perspective correction at segment ends, fixed point stepping in between,
+	// the divide for the next segment end overlapping the current segment
+	int subdivision = std::max(m_floor_subdivision, 1);
+
+	float z = 1.f / w_start;
+	float u = z * uw_start;
+	float v = z * vw_start;
+
+	int i_next = std::min(subdivision, i_end);
+	float z_next = 1.f / (i_next * w_delta + w_start);
+
+	for(int i = 0; i < i_end; ) {
+		float inv_count = 1.f / (i_next - i);
+
+		float u_next = z_next * (i_next * uw_delta + uw_start);
+		float v_next = z_next * (i_next * vw_delta + vw_start);
+
+		int i_after = std::min(i_next + subdivision, i_end);
+		float z_after = 1.f / (i_after * w_delta + w_start);
+
+		std::uint32_t u_fixed = std::uint32_t(std::llround(u * fixed_one));
+		std::uint32_t v_fixed = std::uint32_t(std::llround(v * fixed_one));
+		std::uint32_t u_step = std::uint32_t(std::llround((u_next - u) * inv_count * fixed_one));
+		std::uint32_t v_step = std::uint32_t(std::llround((v_next - v) * inv_count * fixed_one));
+
+		// Texel (u, v) is at 16 * u + v
+		for( ; i < i_next; ++i, ++dst_pixel, u_fixed += u_step, v_fixed += v_step)
+			*dst_pixel = src_pixel[((u_fixed >> 12) & 0xf0) | ((v_fixed >> 16) & 15)];
 
-		*dst_pixel = src_pixel[v_offset * m_texture_atlas->pitch + u_offset];
+		u = u_next;
+		v = v_next;
+		i_next = i_after;
+		z_next = z_after;
 	}
 }
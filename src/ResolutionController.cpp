@@ -0,0 +1,60 @@
+#include "ResolutionController.h"
+#include "RayTraversal.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace reb;
+
+
+
+ResolutionController::ResolutionController(int max_w, int max_h, double target_time) :
+	m_max_w(max_w),
+	m_max_h(max_h),
+	m_target_time(target_time),
+	m_min_scale(.25f),
+	m_scale(1),
+	m_w(max_w),
+	m_h(max_h),
+	m_frame_count(0),
+	m_average_time(0) { }
+
+
+
+bool
+ResolutionController::update(double frame_time) {
+	// Smooth out the frame times, the first frames after a change are skipped
+	// as they pay for the change itself
+	++m_frame_count;
+	if (m_frame_count <= 2)
+		return false;
+	m_average_time = (m_frame_count == 3) ? frame_time : .75 * m_average_time + .25 * frame_time;
+	if (m_frame_count < settle_frame_count)
+		return false;
+
+	// Only react when clearly too slow, or clearly fast enough to grow
+	double ratio = m_target_time / std::max(m_average_time, 1e-6);
+	if ((ratio > .95) and (ratio < 1.25))
+		return false;
+
+	// The cost grows with the number of pixels, thus with the square of the
+	// scale, and the steps are bounded to avoid oscillations
+	float factor = std::min(std::max(float(std::sqrt(ratio)), .7f), 1.1f);
+	int prev_w = m_w, prev_h = m_h;
+	set_scale(m_scale * factor);
+
+	m_frame_count = 0;
+	return (m_w != prev_w) or (m_h != prev_h);
+}
+
+
+
+void
+ResolutionController::set_scale(float scale) {
+	m_scale = std::min(std::max(scale, m_min_scale), 1.f);
+
+	// Width rounded to whole ray packets, height keeping the aspect ratio
+	const int packet_size = RayPacketTraversal::size;
+	m_w = std::max(packet_size, (int(m_scale * m_max_w) / packet_size) * packet_size);
+	m_w = std::min(m_w, m_max_w);
+	m_h = std::max(1, int(std::lround(float(m_w) * m_max_h / m_max_w)));
+}
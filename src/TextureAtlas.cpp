@@ -0,0 +1,31 @@
+#include "TextureAtlas.h"
+#include <algorithm>
+
+using namespace reb;
+
+
+
+TextureAtlas::TextureAtlas(const SDL_Surface* surface) :
+	m_texture_count(0) {
+	int texture_per_row = surface->w / texture_size;
+	int texture_per_column = surface->h / texture_size;
+	m_texture_count = std::min(texture_per_row * texture_per_column, (int)max_texture_count);
+
+	// Swizzle each texture into its own block of texels
+	m_texel_list = ArrayT<std::uint8_t>(std::max(1, m_texture_count) * texel_count);
+	std::fill(m_texel_list.begin(), m_texel_list.end(), 0);
+
+	for(int k = 0; k < m_texture_count; ++k) {
+		std::uint8_t const* src_pixel = (std::uint8_t const*)surface->pixels;
+		src_pixel += texture_size * (k % texture_per_row) + texture_size * surface->pitch * (k / texture_per_row);
+
+		std::uint8_t* dst_texel = m_texel_list.data() + k * texel_count;
+		for(int u = 0; u < texture_size; ++u)
+			for(int v = 0; v < texture_size; ++v)
+				*dst_texel++ = src_pixel[v * surface->pitch + u];
+	}
+
+	// Texture lookup table
+	for(int k = 0; k < max_texture_count; ++k)
+		m_texture_list[k] = m_texel_list.data() + (m_texture_count ? k % m_texture_count : 0) * texel_count;
+}
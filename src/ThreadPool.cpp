@@ -0,0 +1,93 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+using namespace reb;
+
+
+
+ThreadPool::ThreadPool(int thread_count) :
+	m_thread_count(std::max(1, thread_count)),
+	m_generation(0),
+	m_pending_count(0),
+	m_quit(false),
+	m_task_func(0),
+	m_task_data(0) {
+	for(int i = 1; i < m_thread_count; ++i)
+		m_thread_list.push_back(std::thread(&ThreadPool::worker_loop, this, i));
+}
+
+
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+	}
+	m_start_cond.notify_all();
+
+	for(std::thread& thread : m_thread_list)
+		thread.join();
+}
+
+
+
+void
+ThreadPool::dispatch(task_func_type task_func, void* task_data) {
+	// No worker threads, run the task in place
+	if (m_thread_count == 1) {
+		task_func(task_data, 0);
+		return;
+	}
+
+	// Wake up the workers
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_task_func = task_func;
+		m_task_data = task_data;
+		m_pending_count = m_thread_count - 1;
+		++m_generation;
+	}
+	m_start_cond.notify_all();
+
+	// Do our share of the work
+	task_func(task_data, 0);
+
+	// Wait for the workers to be done
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_done_cond.wait(lock, [this] { return m_pending_count == 0; });
+}
+
+
+
+void
+ThreadPool::worker_loop(int thread_index) {
+	unsigned int generation = 0;
+
+	while(true) {
+		// Wait for a task to run
+		task_func_type task_func;
+		void* task_data;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_start_cond.wait(lock, [this, generation] { return m_quit or (m_generation != generation); });
+			if (m_quit)
+				return;
+
+			generation = m_generation;
+			task_func = m_task_func;
+			task_data = m_task_data;
+		}
+
+		// Run the task
+		task_func(task_data, thread_index);
+
+		// Signal that we are done
+		bool last = false;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			last = (--m_pending_count == 0);
+		}
+		if (last)
+			m_done_cond.notify_one();
+	}
+}
@@ -0,0 +1,65 @@
+#include <SDL.h>
+#include <algorithm>
+#include <cstdio>
+#include "Tracer.h"
+
+using namespace reb;
+
+
+
+Tracer::Tracer(int thread_count, std::size_t capacity) :
+	m_capacity(capacity),
+	m_start(clock_type::now()) {
+	for(int k = 0; k < std::max(1, thread_count); ++k)
+		m_ring_list.push_back(std::unique_ptr<Ring>(new Ring(capacity)));
+}
+
+
+
+bool
+Tracer::save(const char* path) const {
+	FILE* file = fopen(path, "w");
+	if (!file) {
+		SDL_SetError("could not open '%s' for writing", path);
+		return false;
+	}
+
+	fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+
+	// Name the threads
+	for(std::size_t k = 0; k < m_ring_list.size(); ++k)
+		fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s %d\"}}",
+		        k ? ",\n" : "", int(k), k ? "render thread" : "main thread", int(k));
+
+	// Events of each thread, oldest first
+	for(std::size_t k = 0; k < m_ring_list.size(); ++k) {
+		const Ring& ring = *m_ring_list[k];
+		std::size_t first = ring.event_count > m_capacity ? ring.event_count - m_capacity : 0;
+
+		// The ring might have lost the begin events of the oldest end events
+		int depth = 0;
+		for(std::size_t n = first; n < ring.event_count; ++n) {
+			const Event& event = ring.event_list[n % m_capacity];
+			if (event.phase == 'E') {
+				if (depth == 0)
+					continue;
+				depth -= 1;
+			}
+			else
+				depth += 1;
+
+			fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": 1, \"tid\": %d}",
+			        event.name, event.phase, 1e-3 * event.time, int(k));
+		}
+	}
+
+	fprintf(file, "\n]}\n");
+
+	if (fclose(file) != 0) {
+		SDL_SetError("could not write '%s'", path);
+		return false;
+	}
+
+	// Job done
+	return true;
+}